@@ -0,0 +1,259 @@
+int __blaze_argc;
+char** __blaze_argv;
+typedef unsigned char* (*t0)(unsigned long, unsigned long);
+typedef void (*t1)(char*);
+typedef void (*t2)(unsigned char*);
+typedef unsigned long (*t3)(char*);
+typedef void (*t4)(unsigned char*, unsigned char*, unsigned long);
+typedef int (*t5)(char*, char*, int);
+typedef int (*t6)(char*, unsigned long, char*, int);
+typedef char* (*t7)(unsigned long);
+typedef struct t8_str t8_str;
+typedef void (*t10)(char*, unsigned long);
+typedef void (*t12)(unsigned long);
+typedef void (*t14)();
+typedef t8_str (*t16)();
+typedef char (*t19)(unsigned long);
+typedef int (*t21)();
+typedef void (*t23)(const t8_str*);
+typedef t8_str (*t25)(int);
+typedef t8_str (*t27)(int);
+
+
+void f0();
+extern int g1_true;
+extern int g4_false;
+extern int __blaze_argc;
+extern char** __blaze_argv;
+unsigned char* calloc(unsigned long a10_n, unsigned long a11_sz);
+void puts(char* a14_s);
+void free(unsigned char* a16_d);
+unsigned long strlen(char* a18_d);
+void memcpy(unsigned char* a21_tgt, unsigned char* a22_src, unsigned long a23_len);
+int sprintf(char* a25_tgt, char* a26_fm, int a27_arg);
+int snprintf(char* a30_tgt, unsigned long a31_len, char* a32_fm, int a33_arg);
+char* f38__setup(t8_str* a39, unsigned long a41_len);
+void f57_new(t8_str* a58, char* a60_s, unsigned long a61_len);
+void f68_new(t8_str* a69, unsigned long a71_len);
+void f74_delete(const t8_str* a75);
+void f81_dup(t8_str* v84, const t8_str* a82);
+char f96_$index(const t8_str* a97, unsigned long a99_i);
+int f103_bool(const t8_str* a104);
+void f110_print(const t8_str* a111_s);
+void f115_argument(t8_str* v117, int a116_i);
+void f130_tos(t8_str* v132, int a131_i);
+
+
+struct t8_str {
+    char* g35__data;
+    unsigned long g36_len;
+    int g37__owned;
+};
+
+
+typedef void (*t58)();
+typedef struct t59_T t59_T;
+typedef void (*t62)(char);
+typedef int (*t64)(int);
+typedef void (*t65)(int);
+typedef int (*t66)();
+typedef char* (*t7)(unsigned long);
+
+
+void f158();
+void f160_delete(const t59_T* a161);
+void f172_new(t59_T* a173, char a175_c);
+int f177_f(int a178_n);
+void f201_g(int a202_n);
+int f214_main();
+
+
+struct t59_T {
+    char g159_c;
+};
+
+
+void f158() {
+    return;
+}
+
+void f160_delete(const t59_T* a161) {
+    t8_str v163_s;
+    int v165;
+    v165 = 1;
+    f38__setup(&(v163_s), v165);
+    v165 = 0;
+    v163_s.g35__data[v165] = ((*a161).g159_c);
+    puts(v163_s.g35__data);
+    f74_delete(&(v163_s));
+;
+    L0:;
+    return;
+}
+
+void f172_new(t59_T* a173, char a175_c) {
+    (*a173).g159_c = (a175_c);
+    L0:;
+    return;
+}
+
+int f177_f(int a178_n) {
+    t59_T v180_a;
+    int v182;
+    int v183;
+    t59_T v186_b;
+    t59_T v194_c;
+    int v196;
+    int v179;
+    v182 = 65;
+    v180_a.g159_c = v182;
+    v182 = 0;
+    v183 = a178_n == v182;
+    if (!(v183)) goto L1;
+    v179 = v182;
+    goto L3;
+    L1:;
+    v182 = 66;
+    v186_b.g159_c = v182;
+    v182 = 1;
+    v183 = a178_n == v182;
+    if (!(v183)) goto L4;
+    v179 = v182;
+    goto L6;
+    L4:;
+    v182 = 2;
+    v183 = a178_n == v182;
+    if (!(v183)) goto L7;
+    v196 = 67;
+    v194_c.g159_c = v196;
+    if (!(v183)) goto L8;
+    v179 = v182;
+    goto L10;
+    L8:;
+    f160_delete(&(v194_c));
+;
+    L7:;
+    v182 = 3;
+    v179 = v182;
+    goto L6;
+    f160_delete(&(v180_a));
+;
+    f160_delete(&(v186_b));
+;
+    goto L0;
+    L10:;
+    f160_delete(&(v194_c));
+;
+    L9:;
+    L6:;
+    f160_delete(&(v186_b));
+;
+    L5:;
+    L3:;
+    f160_delete(&(v180_a));
+;
+    L2:;
+    L0:;
+    return v179;
+}
+
+void f201_g(int a202_n) {
+    t59_T v203_a;
+    int v205;
+    int v206;
+    int v207;
+    t59_T v208_b;
+    int v210;
+    int v213;
+    v205 = 97;
+    v207 = 0;
+    v210 = 98;
+    v213 = 1;
+    L6:;
+    v203_a.g159_c = v205;
+    v206 = a202_n == v207;
+    if (!(v206)) goto L1;
+    goto L3;
+    L1:;
+    v208_b.g159_c = v210;
+    v206 = a202_n - v213;
+    a202_n = v206;
+    f160_delete(&(v203_a));
+;
+    f160_delete(&(v208_b));
+;
+    goto L6;
+    f160_delete(&(v203_a));
+;
+    f160_delete(&(v208_b));
+;
+    goto L0;
+    L3:;
+    f160_delete(&(v203_a));
+;
+    L2:;
+    L0:;
+    return;
+}
+
+int f214_main() {
+    t8_str v217;
+    int v218;
+    int v219;
+    t8_str v222;
+    int v223;
+    t8_str v227;
+    t8_str v232;
+    int v233;
+    int v215;
+    v219 = 0;
+    v218 = f177_f(v219);
+    f130_tos(&(v217), v218);
+    puts(v217.g35__data);
+    v218 = 1;
+    v223 = f177_f(v218);
+    f130_tos(&(v222), v223);
+    puts(v222.g35__data);
+    v218 = 2;
+    v223 = f177_f(v218);
+    f130_tos(&(v227), v223);
+    puts(v227.g35__data);
+    v223 = 3;
+    v233 = f177_f(v223);
+    f130_tos(&(v232), v233);
+    puts(v232.g35__data);
+    f201_g(v218);
+    v215 = v219;
+    goto L4;
+    f74_delete(&(v217));
+;
+    f74_delete(&(v222));
+;
+    f74_delete(&(v227));
+;
+    f74_delete(&(v232));
+;
+    goto L0;
+    L4:;
+    f74_delete(&(v232));
+;
+    L3:;
+    f74_delete(&(v227));
+;
+    L2:;
+    f74_delete(&(v222));
+;
+    L1:;
+    f74_delete(&(v217));
+;
+    L0:;
+    return v215;
+}
+
+int main(int argc, char** argv) {
+    __blaze_argc = argc;
+    __blaze_argv = argv;
+    f0();
+    f158();
+    return f214_main();
+}
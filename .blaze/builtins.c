@@ -0,0 +1,206 @@
+extern int __blaze_argc;
+extern char** __blaze_argv;
+typedef unsigned char* (*t0)(unsigned long, unsigned long);
+typedef void (*t1)(char*);
+typedef void (*t2)(unsigned char*);
+typedef unsigned long (*t3)(char*);
+typedef void (*t4)(unsigned char*, unsigned char*, unsigned long);
+typedef int (*t5)(char*, char*, int);
+typedef int (*t6)(char*, unsigned long, char*, int);
+typedef char* (*t7)(unsigned long);
+typedef struct t8_str t8_str;
+typedef void (*t10)(char*, unsigned long);
+typedef void (*t12)(unsigned long);
+typedef void (*t14)();
+typedef t8_str (*t16)();
+typedef char (*t19)(unsigned long);
+typedef int (*t21)();
+typedef void (*t23)(const t8_str*);
+typedef t8_str (*t25)(int);
+typedef t8_str (*t27)(int);
+
+
+void f0();
+int g1_true;
+int g4_false;
+extern int __blaze_argc;
+extern char** __blaze_argv;
+unsigned char* calloc(unsigned long a10_n, unsigned long a11_sz);
+void puts(char* a14_s);
+void free(unsigned char* a16_d);
+unsigned long strlen(char* a18_d);
+void memcpy(unsigned char* a21_tgt, unsigned char* a22_src, unsigned long a23_len);
+int sprintf(char* a25_tgt, char* a26_fm, int a27_arg);
+int snprintf(char* a30_tgt, unsigned long a31_len, char* a32_fm, int a33_arg);
+char* f38__setup(t8_str* a39, unsigned long a41_len);
+void f57_new(t8_str* a58, char* a60_s, unsigned long a61_len);
+void f68_new(t8_str* a69, unsigned long a71_len);
+void f74_delete(const t8_str* a75);
+void f81_dup(t8_str* v84, const t8_str* a82);
+char f96_$index(const t8_str* a97, unsigned long a99_i);
+int f103_bool(const t8_str* a104);
+void f110_print(const t8_str* a111_s);
+void f115_argument(t8_str* v117, int a116_i);
+void f130_tos(t8_str* v132, int a131_i);
+
+
+struct t8_str {
+    char* g35__data;
+    unsigned long g36_len;
+    int g37__owned;
+};
+
+
+void f0() {
+    int v2;
+    int v3;
+    v3 = 1;
+    v2 = (int)(v3);
+    g1_true = v2;
+    v3 = 0;
+    v2 = (int)(v3);
+    g4_false = v2;
+    return;
+}
+
+char* f38__setup(t8_str* a39, unsigned long a41_len) {
+    int v45;
+    char* v47;
+    unsigned char* v48;
+    unsigned long v49;
+    char* v42;
+    (*a39).g36_len = (a41_len);
+    v45 = 1/*true*/;
+    (*a39).g37__owned = v45;
+    v45 = 1;
+    v49 = (*a39).g36_len + v45;
+    v48 = calloc(v49, v45);
+    v47 = (char*)(v48);
+    (*a39).g35__data = v47;
+    v45 = 0;
+    (*a39).g35__data[(*a39).g36_len] = v45;
+    L0:;
+    return v42;
+}
+
+void f57_new(t8_str* a58, char* a60_s, unsigned long a61_len) {
+    unsigned char* v65;
+    unsigned char* v67;
+    f38__setup(&((*a58)), a61_len);
+    v65 = (unsigned char*)((*a58).g35__data);
+    v67 = (unsigned char*)(a60_s);
+    memcpy(v65, v67, a61_len);
+    L0:;
+    return;
+}
+
+void f68_new(t8_str* a69, unsigned long a71_len) {
+    f38__setup(&((*a69)), a71_len);
+    L0:;
+    return;
+}
+
+void f74_delete(const t8_str* a75) {
+    unsigned char* v79;
+    if (!((*a75).g37__owned)) goto L1;
+    v79 = (unsigned char*)((*a75).g35__data);
+    free(v79);
+    L1:;
+    L0:;
+    return;
+}
+
+void f81_dup(t8_str* v84, const t8_str* a82) {
+    unsigned char* v89;
+    unsigned char* v91;
+    int v95;
+    unsigned long v148;
+    v148 = ((*a82).g36_len);
+    f38__setup(&((*v84)), v148);
+    v89 = (unsigned char*)((*v84).g35__data);
+    v91 = (unsigned char*)((*a82).g35__data);
+    v95 = 1;
+    v148 = (*a82).g36_len + v95;
+    memcpy(v89, v91, v148);
+    goto L1;
+    f74_delete(&((*v84)));
+;
+    goto L0;
+    L1:;
+    L0:;
+    return;
+}
+
+char f96_$index(const t8_str* a97, unsigned long a99_i) {
+    char v100;
+    v100 = (*a97).g35__data[a99_i];
+    goto L0;
+    L0:;
+    return v100;
+}
+
+int f103_bool(const t8_str* a104) {
+    int v107;
+    int v109;
+    int v106;
+    v109 = 0;
+    v107 = (*a104).g36_len != v109;
+    v106 = v107;
+    goto L0;
+    L0:;
+    return v106;
+}
+
+void f110_print(const t8_str* a111_s) {
+    puts((*a111_s).g35__data);
+    L0:;
+    return;
+}
+
+void f115_argument(t8_str* v117, int a116_i) {
+    char* v118_arg;
+    unsigned long v120_len;
+    unsigned char* v125;
+    unsigned char* v127;
+    int v129;
+    unsigned long v152;
+    v118_arg = (__blaze_argv[a116_i]);
+    v120_len = strlen(v118_arg);
+    v152 = (v120_len);
+    f38__setup(&((*v117)), v152);
+    v125 = (unsigned char*)((*v117).g35__data);
+    v127 = (unsigned char*)(v118_arg);
+    v129 = 1;
+    v152 = v120_len + v129;
+    memcpy(v125, v127, v152);
+    goto L1;
+    f74_delete(&((*v117)));
+;
+    goto L0;
+    L1:;
+    L0:;
+    return;
+}
+
+void f130_tos(t8_str* v132, int a131_i) {
+    int v133_len;
+    char* v135;
+    int v136;
+    static const t8_str v139 = {"%d", sizeof("%d")-1};
+    unsigned long v142;
+    static const t8_str v146 = {"%d", sizeof("%d")-1};
+    v136 = 0;
+    v135 = (char*)(v136);
+    v133_len = snprintf(v135, v136, v139.g35__data, a131_i);
+    v142 = (unsigned long)(v133_len);
+    f38__setup(&((*v132)), v142);
+    sprintf((*v132).g35__data, v146.g35__data, a131_i);
+    goto L1;
+    f74_delete(&((*v132)));
+;
+    goto L0;
+    L1:;
+    L0:;
+    return;
+}
+
@@ -38,118 +38,144 @@ static void* alloc(size_t sz) {
     return res;
 }
 
-typedef void* (*spawn_func)(void* ptr);
+File* all_files;
+int nfiles;
+// How many files are hashed or compiled at once.
+int jobs;
 
-#ifdef NO_THREADS
+// What the workers do with each queued file.
+typedef void (*job_func)(File* f);
 
-typedef struct {
-    spawn_func func;
-    void* arg;
-} Thread;
-#define MAX_PROCESSING 1
+#ifdef NO_THREADS
 
-static void spawn(spawn_func f, Thread* t, void* arg) {
-    t->func = f;
-    t->arg = arg;
-}
+static job_func job;
 
-static void stop(Thread t) {}
-static void thread_setup() {}
+static void start(job_func f) { job = f; }
+static void queue_file(File* f) { job(f); }
+static void wait_all() {}
 
 #elif HAVE_PTHREAD_H
 #include <pthread.h>
-
-typedef pthread_t Thread;
-
-static void spawn(spawn_func f, Thread* t, void* arg) {
-    int err;
-    if ((err = pthread_create(t, NULL, f, arg)))
-        fatal(strerror(err), NULL);
+#include <fcntl.h>
+#include <poll.h>
+
+/* Files are queued in order and taken by the first idle worker. The workers
+   sleep on a condition variable while the queue is empty, and exit once it's
+   empty and wait_all has been called. */
+static pthread_t* threads;
+static int nthreads;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static File** queue;
+static int head, tail, stopping;
+static job_func job;
+
+/* When run by make -j, jobs past the first need a token from make's jobserver
+   so the machine isn't oversubscribed. The first one runs in the slot make
+   gave lightbuild itself. */
+static int token_r = -1, token_w = -1, implicit;
+
+static void jobserver_setup() {
+    const char* flags = getenv("MAKEFLAGS"), *p, *auth = NULL;
+    char path[1024];
+    int r, w;
+    if (!flags) return;
+    // Older versions of make call it --jobserver-fds.
+    for (p = flags; (p = strstr(p, "--jobserver-")); ++p)
+        if (!strncmp(p, "--jobserver-auth=", 17)) auth = p+17;
+        else if (!strncmp(p, "--jobserver-fds=", 16)) auth = p+16;
+    if (!auth) return;
+
+    if (sscanf(auth, "fifo:%1023[^ ]", path) == 1) {
+        if ((token_r = token_w = open(path, O_RDWR)) == -1)
+            fprintf(stderr, "warning: can't open jobserver %s: %s\n", path,
+                    strerror(errno));
+    } else if (sscanf(auth, "%d,%d", &r, &w) == 2) {
+        // make only passes them on to commands it knows are make-like.
+        if (fcntl(r, F_GETFD) == -1 || fcntl(w, F_GETFD) == -1) return;
+        token_r = r;
+        token_w = w;
+    }
 }
 
-static void stop(Thread t) {
-    void* ret;
-    assert(pthread_cancel(t) == 0);
-    assert(pthread_join(t, &ret) == 0);
-    assert(ret == PTHREAD_CANCELED);
+static char acquire() {
+    struct pollfd pfd;
+    char c;
+    pfd.fd = token_r;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (read(token_r, &c, 1) == 1) return c;
+        if (errno == EAGAIN) poll(&pfd, 1, -1);
+        else if (errno != EINTR) fatal(strerror(errno), "jobserver");
+    }
 }
 
-static void thread_setup() {
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+static void release(char c) {
+    while (write(token_w, &c, 1) != 1)
+        if (errno != EINTR && errno != EAGAIN) fatal(strerror(errno), "jobserver");
 }
 
-#define MAX_PROCESSING 10
-#else
-#error TODO
-#define MAX_PROCESSING 1
-#endif
-
-Thread threads[MAX_PROCESSING];
-File* all_files;
-int nfiles;
-File* processing[MAX_PROCESSING];
-
-#ifdef NO_THREADS
-
-#define atomic_load(x) (*(x))
-#define atomic_store(x,v) do { *(x) = (v); return NULL; } while (0)
-#define queue_test(n,f) do {\
-    processing[n] = f;\
-    threads[n].func(threads[n].arg);\
-    return;\
-} while (0)
-
-#elif __GNUC__
-
-#ifdef __ATOMIC_SEQ_CST
-#define atomic_load(x) __atomic_load_n(x, __ATOMIC_SEQ_CST)
-#define atomic_store(x,v) __atomic_store_n(x, v, __ATOMIC_SEQ_CST)
-#define queue_test(n,f) do {\
-    File* expected = NULL;\
-    if (__atomic_compare_exchange_n(&processing[n], &expected, f, 0,\
-        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) return;\
-} while (0)
-#else
-#error TODO
-#endif
-
-#else
-
-#error TODO
-
-#endif
+static void* worker(void* unused) {
+    File* f;
+    int token;
+    char c = 0;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (head == tail && !stopping) pthread_cond_wait(&queued, &lock);
+        if (head == tail) break;
+        f = queue[head++];
+        token = token_r != -1 && implicit;
+        if (!token) implicit = 1;
+        pthread_mutex_unlock(&lock);
+        if (token) c = acquire();
+        job(f);
+        if (token) release(c);
+        pthread_mutex_lock(&lock);
+        if (!token) implicit = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
 
-#define exists(f) (access(f, F_OK) != -1)
+static void start(job_func f) {
+    int err;
+    if (!queue) {
+        queue = alloc(nfiles*sizeof(File*));
+        if (jobs > nfiles) jobs = nfiles;
+        threads = alloc(jobs*sizeof(pthread_t));
+        jobserver_setup();
+    }
+    job = f;
+    head = tail = stopping = 0;
+    for (nthreads=0; nthreads<jobs; ++nthreads)
+        if ((err = pthread_create(&threads[nthreads], NULL, worker, NULL)))
+            fatal(strerror(err), NULL);
+}
 
 static void queue_file(File* f) {
-    int i;
-    for (;;) for (i=0; i<MAX_PROCESSING; ++i) queue_test(i, f);
+    pthread_mutex_lock(&lock);
+    assert(tail < nfiles);
+    queue[tail++] = f;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
 }
 
-#ifdef NO_THREADS
-
-static void wait_all() {}
-
-#else
-
 static void wait_all() {
-    int i, cont;
-    for (;;) {
-        cont = 0;
-        for (i=0; i<MAX_PROCESSING; ++i)
-            if (atomic_load(&processing[i])) {
-                cont = 1;
-                break;
-            }
-        if (!cont) {
-            for (i=0; i<MAX_PROCESSING; ++i) stop(threads[i]);
-            return;
-        }
-    }
+    int i, err;
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+    for (i=0; i<nthreads; ++i)
+        if ((err = pthread_join(threads[i], NULL))) fatal(strerror(err), NULL);
 }
 
+#else
+#error TODO
 #endif
 
+#define exists(f) (access(f, F_OK) != -1)
+
 static Options opts;
 
 static void parse() {
@@ -266,23 +292,15 @@ end:
     return dirty;
 }
 
-static void* dirty_thread(void* fv) {
-    File** ptr = fv;
-    File* f = NULL;
-    thread_setup();
-    for (;;) {
-        while (!(f = atomic_load(ptr)));
-        f->dirty = is_dirty(f->path, f->obj) || f->dirty;
-        atomic_store(ptr, NULL);
-    }
+static void dirty_job(File* f) {
+    f->dirty = is_dirty(f->path, f->obj) || f->dirty;
 }
 
 static void dirty_tests() {
     int i;
     if (is_dirty(script, NULL))
         for (i=0; i<nfiles; ++i) all_files[i].dirty = 1;
-    for (i=0; i<MAX_PROCESSING; ++i)
-        spawn(dirty_thread, &threads[i], &processing[i]);
+    start(dirty_job);
     for (i=0; i<nfiles; ++i) queue_file(&all_files[i]);
     wait_all();
 }
@@ -309,17 +327,6 @@ static void compile(File* f) {
     free(buf);
 }
 
-static void* compile_thread(void* fv) {
-    File** ptr = fv;
-    File* f;
-    thread_setup();
-    for (;;) {
-        while (!(f = atomic_load(ptr)));
-        compile(f);
-        atomic_store(ptr, NULL);
-    }
-}
-
 static void link_objects() {
     size_t pos = 0, total = opts.compiler_l + 1 + opts.lflags_l + 1 +
                             opts.exeflag_l + 1 + opts.target_l + 1;
@@ -344,8 +351,7 @@ static void build() {
 
     if (!target_dirty && exists(opts.target)) return;
 
-    for (i=0; i<MAX_PROCESSING; ++i)
-        spawn(compile_thread, &threads[i], &processing[i]);
+    start(compile);
     for (i=0; i<nfiles; ++i)
         if (all_files[i].dirty) queue_file(&all_files[i]);
     wait_all();
@@ -360,6 +366,10 @@ static void free_all() {
         free(all_files[i].obj);
     }
     free(all_files);
+    #ifndef NO_THREADS
+    free(queue);
+    free(threads);
+    #endif
     free(opts.compiler);
     free(opts.cflags);
     free(opts.lflags);
@@ -368,8 +378,17 @@ static void free_all() {
 }
 
 int main(int argc, char** argv) {
-    if (argc != 2) fatal("usage: lightbuild <build script>", NULL);
-    script = argv[1];
+    const char* usage = "usage: lightbuild [-j jobs] <build script>", *n;
+    int arg = 1;
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+    if (arg < argc && !strncmp(argv[arg], "-j", 2)) {
+        n = argv[arg][2] ? argv[arg]+2 : argv[++arg];
+        if (!n || (jobs = atoi(n)) < 1) fatal(usage, NULL);
+        ++arg;
+    }
+    if (argc - arg != 1) fatal(usage, NULL);
+    script = argv[arg];
     parse();
     dirty_tests();
     build();
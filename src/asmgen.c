@@ -0,0 +1,631 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "blaze.h"
+#include <ctype.h>
+
+/* Writes modules as x86-64 assembly for the GNU assembler, so quick builds
+   skip the C compiler. Calls follow the SysV ABI, so C functions can be
+   imported directly. Each instruction is lowered on its own: the scalar
+   locals linear scan gives one of the callee-saved registers live there, and
+   everything else lives in the frame. Symbols are named like cgen names them. */
+
+int native = 0;
+
+#define NREGS 5
+static const char* regs[NREGS] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+static const char* arg_regs[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+typedef struct Loc {
+    int reg; // 1 + the index in regs of the var's register, or 0 if it has none.
+    int off; // Where the var is in the frame, relative to %rbp.
+    int first, last; // The instructions the var is live between (see allocate).
+    int fixed; // Does the var have to stay in the frame?
+} Loc;
+
+// The function being written, and where its variables are, by id.
+static Decl* fun = NULL;
+static Loc* locs = NULL;
+// Numbers the functions of the module, so their labels don't clash.
+static int fun_id = 0;
+// The string literals of the module, written after its functions.
+static Buf strings = {NULL, 0, 0};
+// The module initializers main calls, in the order they're written.
+static List(const char*) inits = NULL;
+
+static int size_of(Type* t);
+
+static int align_of(Type* t) {
+    int i, a = 1;
+    if (t->kind != Tstruct) return size_of(t);
+    for (i=0; i<list_len(t->d.sons); ++i) {
+        Decl* d = t->d.sons[i];
+        if (d->kind == Dglobal && align_of(d->v->type) > a) a = align_of(d->v->type);
+    }
+    return a;
+}
+
+/* Lays t out the way C compilers do, and returns the offset of its field f,
+   or its size if f is NULL. */
+static int offset_of(Type* t, Var* f) {
+    int i, a, n = 0;
+    for (i=0; i<list_len(t->d.sons); ++i) {
+        Decl* d = t->d.sons[i];
+        if (d->kind != Dglobal) continue;
+        a = align_of(d->v->type);
+        n = (n+a-1) / a * a;
+        if (d->v == f) return n;
+        n += size_of(d->v->type);
+    }
+    bassert(!f, "%s isn't a field of %s", f->name->str, t->name->str);
+    a = align_of(t);
+    return (n+a-1) / a * a;
+}
+
+static int size_of(Type* t) {
+    static const int sizes[] = {4, 1, 1, 8, 4};
+    bassert(t, "expected non-null type");
+    switch (t->kind) {
+    case Tbuiltin: return sizes[t->bkind];
+    case Tptr: case Tfun: return 8;
+    case Tstruct: return offset_of(t, NULL);
+    default: fatal("unexpected type kind %d", t->kind);
+    }
+}
+
+// Are operations on t unsigned? Smaller types are promoted to int first.
+static int is_unsigned(Type* t) {
+    return t->kind != Tbuiltin || t->bkind == Tsize;
+}
+
+// How a value of type t is loaded into a 64-bit register, extended like C does.
+static const char* load_op(Type* t) {
+    static const char* ops[] = {"movslq", "movzbq", "movsbq", "movq", "movslq"};
+    return t->kind == Tbuiltin ? ops[t->bkind] : "movq";
+}
+
+// How the value in %rax is stored to a value of type t.
+static const char* store_op(Type* t) {
+    switch (size_of(t)) {
+    case 1: return "movb %al";
+    case 4: return "movl %eax";
+    default: return "movq %rax";
+    }
+}
+
+// Truncates %rax to t and extends it back, so it's what loading it would give.
+static void normalize(Type* t, Buf* output) {
+    static const char* ops[] = {"movslq %eax", "movzbq %al", "movsbq %al", NULL,
+                                "movslq %eax"};
+    if (t->kind == Tbuiltin && ops[t->bkind])
+        buf_printf(output, "    %s, %%rax\n", ops[t->bkind]);
+}
+
+// The type of v. That of a deref isn't always set to what its base points to.
+static Type* type_of(Var* v) {
+    return v->deref && v->base->type->kind == Tptr ? v->base->type->sons[0] : v->type;
+}
+
+// Does v name a decl (a global or a function) rather than a local?
+static int is_decl(Var* v) { return v->owner->v == v; }
+
+static Loc* loc(Var* v) {
+    bassert(v->owner == fun && v->id < fun->ids, "var %d isn't a local", v->id);
+    return &locs[v->id];
+}
+
+static int in_reg(Var* v) {
+    return !v->base && !is_decl(v) && !(v->ir && v->ir->kind == Istr) &&
+           loc(v)->reg;
+}
+
+// A memory operand: disp(reg), or sym+disp(%rip) if sym isn't empty.
+typedef struct Place {
+    char sym[256];
+    const char* reg;
+    int disp;
+} Place;
+
+static void put_place(Place p, Buf* output) {
+    if (*p.sym) {
+        buf_puts(output, p.sym);
+        if (p.disp) buf_printf(output, "+%d", p.disp);
+        buf_puts(output, "(%rip)");
+    } else buf_printf(output, "%d(%s)", p.disp, p.reg);
+}
+
+static void load(Var* v, const char* reg, Buf* output);
+
+/* Returns where v is, loading what it takes to get there into %r11 (and
+   using %rcx for indexes). */
+static Place place(Var* v, Buf* output);
+
+// Where the first n attributes of av lead from base.
+static Place attr_place(Var* base, Var*** av, int n, Buf* output) {
+    Place p = place(base, output);
+    Type* t = type_of(base);
+    int i;
+    for (i=0; i<n; ++i) {
+        p.disp += offset_of(t, *av[i]);
+        t = (*av[i])->type;
+    }
+    return p;
+}
+
+static Place place(Var* v, Buf* output) {
+    Place p = {"", "%r11", 0};
+    Type* t;
+    int i, size;
+
+    if (v->deref) load(v->base, "%r11", output);
+    else if (v->av) p = attr_place(v->base, v->av, list_len(v->av), output);
+    else if (v->iv) {
+        load(v->iv[0], "%rcx", output);
+        buf_puts(output, "    pushq %rcx\n");
+        load(v->base, "%r11", output);
+        buf_puts(output, "    popq %rcx\n");
+        for (t=type_of(v->base), i=0;;) {
+            t = t->sons[0];
+            size = size_of(t);
+            if (size != 1) buf_printf(output, "    imulq $%d, %%rcx\n", size);
+            buf_puts(output, "    addq %rcx, %r11\n");
+            if (++i == list_len(v->iv)) break;
+            buf_puts(output, "    movq (%r11), %r11\n    pushq %r11\n");
+            load(v->iv[i], "%rcx", output);
+            buf_puts(output, "    popq %r11\n");
+        }
+    } else if (is_decl(v))
+        snprintf(p.sym, sizeof(p.sym), "%s", cgen_declname(v->owner));
+    else if (v->ir && v->ir->kind == Istr)
+        snprintf(p.sym, sizeof(p.sym), ".LS%d_%d", fun_id, v->id);
+    else {
+        bassert(!loc(v)->reg, "var %d is in a register", v->id);
+        p.reg = "%rbp";
+        p.disp = loc(v)->off;
+    }
+    return p;
+}
+
+static void load(Var* v, const char* reg, Buf* output) {
+    Place p;
+    if (is_decl(v) && v->owner->kind == Dfun)
+        buf_printf(output, v->owner->import ? "    movq %s@GOTPCREL(%%rip), %s\n"
+                                            : "    leaq %s(%%rip), %s\n",
+                   cgen_declname(v->owner), reg);
+    else if (in_reg(v)) buf_printf(output, "    movq %s, %s\n", regs[loc(v)->reg-1], reg);
+    else {
+        p = place(v, output);
+        buf_printf(output, "    %s ", load_op(type_of(v)));
+        put_place(p, output);
+        buf_printf(output, ", %s\n", reg);
+    }
+}
+
+// Stores %rax to v.
+static void store(Var* v, Buf* output) {
+    Place p;
+    if (in_reg(v)) {
+        normalize(type_of(v), output);
+        buf_printf(output, "    movq %%rax, %s\n", regs[loc(v)->reg-1]);
+    } else {
+        p = place(v, output);
+        buf_printf(output, "    %s, ", store_op(type_of(v)));
+        put_place(p, output);
+        buf_putc(output, '\n');
+    }
+}
+
+static void addr_of(Var* v, const char* reg, Buf* output) {
+    Place p;
+    if (v->deref) load(v->base, reg, output);
+    else {
+        p = place(v, output);
+        buf_puts(output, "    leaq ");
+        put_place(p, output);
+        buf_printf(output, ", %s\n", reg);
+    }
+}
+
+static void call_decl(Decl* d, Buf* output) {
+    buf_printf(output, "    call %s%s\n", cgen_declname(d), d->import ? "@PLT" : "");
+}
+
+// The function that copies values of type t, if there is one.
+static Decl* copy_fun(Type* t) {
+    if (t->kind != Tstruct || !t->n->magic[Mcopy]) return NULL;
+    return t->n->magic[Mcopy]->overloads[0]->n->d;
+}
+
+/* Sets dst (or what it points to, if dstaddr) to src, which is copied unless
+   it's moved. */
+static void set(Var* dst, int dstaddr, Var* src, int move, Buf* output) {
+    Type* t = type_of(src);
+    Decl* copy = move ? NULL : copy_fun(t);
+    if (t->kind != Tstruct) {
+        bassert(!dstaddr, "scalar set through an address");
+        load(src, "%rax", output);
+        store(dst, output);
+        return;
+    }
+    addr_of(src, "%rax", output);
+    if (dstaddr) load(dst, "%rdi", output);
+    else addr_of(dst, "%rdi", output);
+    buf_puts(output, "    movq %rax, %rsi\n");
+    if (copy) {
+        bassert(copy->ra, "copy function that doesn't return through an address");
+        call_decl(copy, output);
+    } else buf_printf(output, "    movl $%d, %%ecx\n    rep movsb\n", size_of(t));
+}
+
+/* Calls f with the address of first if it isn't NULL, then this if f is a
+   method called through an attribute, then args. Every argument is pushed
+   and the first six are popped into their registers. */
+static void call(Var* f, Var* first, Var** args, int nargs, Buf* output) {
+    Var* t = call_target(f);
+    int this = f->base && f->av && t->flags & Fstc;
+    int direct = is_decl(t) && t->owner->kind == Dfun;
+    int n = nargs + (first != NULL) + this, stack = n > 6 ? n-6 : 0, i;
+    Place p;
+
+    // The stack has to stay 16-byte aligned.
+    if (stack % 2) buf_puts(output, "    subq $8, %rsp\n");
+    for (i=nargs-1; i>=0; --i) {
+        bassert(type_of(args[i])->kind != Tstruct,
+                "struct passed by value to a C function");
+        load(args[i], "%rax", output);
+        buf_puts(output, "    pushq %rax\n");
+    }
+    if (this) {
+        p = attr_place(f->base, f->av, list_len(f->av)-1, output);
+        buf_puts(output, "    leaq ");
+        put_place(p, output);
+        buf_puts(output, ", %rax\n    pushq %rax\n");
+    }
+    if (first) {
+        addr_of(first, "%rax", output);
+        buf_puts(output, "    pushq %rax\n");
+    }
+    if (!direct) load(f, "%r10", output);
+    for (i=0; i<n && i<6; ++i) buf_printf(output, "    popq %s\n", arg_regs[i]);
+    // Calls to variadic C functions pass no vector registers.
+    buf_puts(output, "    xorl %eax, %eax\n");
+    if (direct) call_decl(t->owner, output);
+    else buf_puts(output, "    call *%r10\n");
+    if (stack) buf_printf(output, "    addq $%d, %%rsp\n", (stack + stack%2)*8);
+}
+
+static void asmgen_op(Instr* ir, Buf* output) {
+    static const char* sets[][2] = {{NULL}, {NULL}, {NULL}, {NULL}, {NULL},
+                                    {"sete", "sete"}, {"setne", "setne"},
+                                    {"setl", "setb"}, {"setg", "seta"}};
+    int uns = is_unsigned(type_of(ir->v[0])) || is_unsigned(type_of(ir->v[1]));
+    load(ir->v[0], "%rax", output);
+    load(ir->v[1], "%rcx", output);
+    switch (ir->op) {
+    case Oadd: buf_puts(output, "    addq %rcx, %rax\n"); break;
+    case Osub: buf_puts(output, "    subq %rcx, %rax\n"); break;
+    case Omul: buf_puts(output, "    imulq %rcx, %rax\n"); break;
+    case Odiv:
+        buf_puts(output, uns ? "    xorl %edx, %edx\n    divq %rcx\n"
+                             : "    cqto\n    idivq %rcx\n");
+        break;
+    case Oeq: case One: case Olt: case Ogt:
+        buf_printf(output, "    cmpq %%rcx, %%rax\n    %s %%al\n"
+                           "    movzbl %%al, %%eax\n", sets[ir->op][uns]);
+        break;
+    default: fatal("unexpected op %d", ir->op);
+    }
+}
+
+static void asmgen_ir(Decl* d, Instr* ir, Buf* output) {
+    Var* t;
+    int raddr;
+
+    switch (ir->kind) {
+    case Inull: case Istr: break;
+    case Iint:
+        buf_puts(output, "    movabsq $");
+        buf_putsz(output, ir->s->str, strspn(ir->s->str, "0123456789"));
+        buf_puts(output, ", %rax\n");
+        store(ir->dst, output);
+        break;
+    case Iaddr:
+        if (ir->dst->uses == 0) break;
+        addr_of(ir->v[0], "%rax", output);
+        store(ir->dst, output);
+        break;
+    case Icast:
+        load(ir->v[0], "%rax", output);
+        store(ir->dst, output);
+        break;
+    case Iop:
+        asmgen_op(ir, output);
+        store(ir->dst, output);
+        break;
+    case Icall:
+        t = call_target(ir->v[0]);
+        raddr = t->owner->v == t && t->owner->ra;
+        call(ir->v[0], raddr ? ir->dst : NULL, ir->v+1, list_len(ir->v)-1, output);
+        if (!raddr && ir->dst && ir->dst->type) store(ir->dst, output);
+        break;
+    case Iconstr:
+        call(ir->v[0], ir->dst, ir->v+1, list_len(ir->v)-1, output);
+        break;
+    case Idel:
+        if (ir->v[1]->type) call(ir->v[0], ir->v[1], NULL, 0, output);
+        break;
+    case Inew:
+        if (ir->dst->type) set(ir->dst, 0, ir->v[0], 0, output);
+        break;
+    case Iset:
+        set(ir->v[0], 0, ir->v[1], ir->flags & Fmove, output);
+        break;
+    case Isr:
+        // Only locals are moved, like in cgen.
+        if (ir->v) set(d->rv, d->ra, ir->v[0], movable(d, ir->v[0]), output);
+        break;
+    case Icjmp:
+        load(ir->v[0], "%rax", output);
+        buf_printf(output, "    testq %%rax, %%rax\n    jz .L%d_%d\n", fun_id,
+                   ir->label);
+        break;
+    case Ijmp:
+        buf_printf(output, "    jmp .L%d_%d\n", fun_id, ir->label);
+        break;
+    case Ilabel:
+        buf_printf(output, ".L%d_%d:\n", fun_id, ir->label);
+        break;
+    }
+}
+
+// Notes that v, or the vars it's reached through, are used at i.
+static void use(Var* v, int i) {
+    int j;
+    Loc* l;
+    if (v->base) {
+        use(v->base, i);
+        for (j=0; j<list_len(v->iv); ++j) use(v->iv[j], i);
+    } else if (!is_decl(v) && v->owner == fun) {
+        l = loc(v);
+        if (l->first < 0) l->first = i;
+        if (l->last < i) l->last = i;
+    }
+}
+
+static int allocatable(Var* v) {
+    return v->type && v->type->kind != Tstruct && !v->base &&
+           !(v->ir && v->ir->kind == Istr) && !loc(v)->fixed && loc(v)->first >= 0;
+}
+
+static int by_first(const void* a, const void* b) {
+    return loc(*(Var**)a)->first - loc(*(Var**)b)->first;
+}
+
+/* Linear scan register allocation. Instruction i is at i+1, and the entry and
+   exit of the function are at 0 and n+1. A var used anywhere in a loop is live
+   throughout it, so it isn't clobbered by the next iteration. */
+static void allocate(Decl* d, List(Var*) vars) {
+    int n = list_len(d->sons), i, j, r, h, changed;
+    int* at = alloc(sizeof(int)*(d->labels+1));
+    Var* active[NREGS] = {NULL};
+    List(Var*) order = NULL;
+
+    for (i=0; i<list_len(d->args); ++i) use(d->args[i], 0);
+    if (d->ra) use(d->rv, 0);
+    for (i=0; i<n; ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Ilabel) at[ir->label] = i+1;
+        if (ir->kind == Inull) continue;
+        // Anything whose address is taken has to stay in memory.
+        if (ir->kind == Iaddr && !ir->v[0]->deref) {
+            Var* v = ir->v[0];
+            while (v->base && !v->deref) v = v->base;
+            if (!v->base && !is_decl(v)) loc(v)->fixed = 1;
+        }
+        if (ir->dst) use(ir->dst, i+1);
+        for (j=0; j<list_len(ir->v); ++j) use(ir->v[j], i+1);
+        if (ir->kind == Isr) use(d->rv, i+1);
+    }
+    if (d->rv && !d->ra) use(d->rv, n+1);
+
+    do {
+        changed = 0;
+        for (i=0; i<n; ++i) {
+            Instr* ir = d->sons[i];
+            if ((ir->kind != Ijmp && ir->kind != Icjmp) || (h = at[ir->label]) > i+1)
+                continue;
+            for (j=0; j<list_len(vars); ++j) {
+                Loc* l = loc(vars[j]);
+                if (l->first < 0 || l->first > i+1 || l->last < h ||
+                    (l->first <= h && l->last >= i+1)) continue;
+                if (l->first > h) l->first = h;
+                if (l->last < i+1) l->last = i+1;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    for (i=0; i<list_len(vars); ++i)
+        if (allocatable(vars[i])) list_append(order, vars[i]);
+    if (order) qsort(order, list_len(order), sizeof(Var*), by_first);
+    for (i=0; i<list_len(order); ++i) {
+        Loc* l = loc(order[i]);
+        for (r=0; r<NREGS; ++r)
+            if (active[r] && loc(active[r])->last < l->first) active[r] = NULL;
+        for (r=0; r<NREGS && active[r]; ++r);
+        // Spill whichever lives longest.
+        if (r == NREGS) {
+            for (j=r=0; j<NREGS; ++j)
+                if (loc(active[j])->last > loc(active[r])->last) r = j;
+            if (loc(active[r])->last <= l->last) continue;
+            loc(active[r])->reg = 0;
+        }
+        active[r] = order[i];
+        l->reg = r+1;
+    }
+
+    list_free(order);
+    free(at);
+}
+
+// Writes the bytes of a literal spelled like in C, escapes and all.
+static void asmgen_bytes(const char* s, Buf* output) {
+    int c, n, k = 0;
+    while (*s) {
+        c = (unsigned char)*s++;
+        if (c == '\\') switch (c = (unsigned char)*s++) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case 'x':
+            for (c=0; isxdigit((unsigned char)*s); ++s)
+                c = c*16 + (isdigit((unsigned char)*s) ? *s-'0' : tolower(*s)-'a'+10);
+            break;
+        default:
+            // Octal, or the character itself as with \\ and \?.
+            if (c >= '0' && c <= '7')
+                for (c -= '0', n=1; n<3 && *s >= '0' && *s <= '7'; ++n)
+                    c = c*8 + *s++ - '0';
+        }
+        buf_printf(output, k++ % 16 ? ", %d" : "    .byte %d", c & 0xff);
+        if (k % 16 == 0 || !*s) buf_putc(output, '\n');
+    }
+}
+
+/* Literals are read-only like cgen's static const ones. The str needs its
+   pointer relocated, so it goes where the dynamic linker can write it first. */
+static void asmgen_strlit(Var* v) {
+    buf_puts(&strings, "    .section .data.rel.ro.local,\"aw\"\n");
+    buf_printf(&strings, "    .balign 8\n.LS%d_%d:\n", fun_id, v->id);
+    buf_printf(&strings, "    .quad .LS%d_%dd\n", fun_id, v->id);
+    buf_printf(&strings, "    .quad .LS%d_%de-.LS%d_%dd\n", fun_id, v->id, fun_id, v->id);
+    buf_printf(&strings, "    .zero %d\n", size_of(v->type)-16);
+    buf_puts(&strings, "    .section .rodata\n");
+    buf_printf(&strings, ".LS%d_%dd:\n", fun_id, v->id);
+    asmgen_bytes(v->ir->s->str, &strings);
+    buf_printf(&strings, ".LS%d_%de:\n    .byte 0\n", fun_id, v->id);
+}
+
+static void asmgen_fun(Decl* d, Buf* output) {
+    List(Var*) vars = NULL;
+    const char* name = cgen_declname(d);
+    int i, nargs, nregs = 0, off, a, used[NREGS] = {0};
+
+    fun = d;
+    ++fun_id;
+    locs = alloc(sizeof(Loc)*(d->ids+1));
+    for (i=0; i<d->ids; ++i) locs[i].first = locs[i].last = -1;
+
+    // The return address is passed first, and arguments after the sixth on the
+    // stack, above the return address and the saved %rbp.
+    if (d->ra) list_append(vars, d->rv);
+    for (i=0; i<list_len(d->args); ++i) list_append(vars, d->args[i]);
+    nargs = list_len(vars);
+    for (i=6; i<nargs; ++i) {
+        loc(vars[i])->fixed = 1;
+        loc(vars[i])->off = 16 + (i-6)*8;
+    }
+    for (i=0; i<list_len(d->vars); ++i)
+        if (d->vars[i]->type && !d->vars[i]->deref) list_append(vars, d->vars[i]);
+    if (d->rv && !d->ra) list_append(vars, d->rv);
+
+    allocate(d, vars);
+    for (i=0; i<list_len(vars); ++i)
+        if (loc(vars[i])->reg) used[loc(vars[i])->reg-1] = 1;
+    for (i=0; i<NREGS; ++i) nregs += used[i];
+
+    off = -nregs*8;
+    for (i=0; i<list_len(vars); ++i) {
+        Var* v = vars[i];
+        Loc* l = loc(v);
+        if (l->reg || l->off > 0) continue;
+        if (v->ir && v->ir->kind == Istr) {
+            asmgen_strlit(v);
+            continue;
+        }
+        a = align_of(v->type);
+        l->off = off = -((size_of(v->type) - off + a-1) / a * a);
+    }
+    off = (-off + 15) / 16 * 16;
+
+    if (d->export || d->exportc) buf_printf(output, "    .globl %s\n", name);
+    buf_printf(output, "    .type %s, @function\n%s:\n", name, name);
+    buf_puts(output, "    pushq %rbp\n    movq %rsp, %rbp\n");
+    for (i=0; i<NREGS; ++i)
+        if (used[i]) buf_printf(output, "    pushq %s\n", regs[i]);
+    if (off > nregs*8) buf_printf(output, "    subq $%d, %%rsp\n", off - nregs*8);
+    for (i=0; i<nargs && i<6; ++i) {
+        buf_printf(output, "    movq %s, %%rax\n", arg_regs[i]);
+        store(vars[i], output);
+    }
+
+    for (i=0; i<list_len(d->sons); ++i) asmgen_ir(d, d->sons[i], output);
+
+    if (d->rv && !d->ra) load(d->rv, "%rax", output);
+    buf_printf(output, "    leaq %d(%%rbp), %%rsp\n", -nregs*8);
+    for (i=NREGS-1; i>=0; --i)
+        if (used[i]) buf_printf(output, "    popq %s\n", regs[i]);
+    buf_puts(output, "    popq %rbp\n    ret\n\n");
+
+    list_free(vars);
+    free(locs);
+    locs = NULL;
+    fun = NULL;
+}
+
+static void asmgen_global(Decl* d, Buf* output) {
+    const char* name = cgen_declname(d);
+    const char* value = d->value ? d->value->str : NULL;
+    int size = size_of(d->v->type);
+    buf_printf(output, "    .globl %s\n    .balign %d\n%s:\n", name,
+               align_of(d->v->type), name);
+    if (!value) buf_printf(output, "    .zero %d\n", size);
+    else {
+        buf_puts(output, size == 1 ? "    .byte " : size == 4 ? "    .long "
+                                                            : "    .quad ");
+        // Leave off the suffix of unsigned longs.
+        buf_putsz(output, value, strspn(value, "-0123456789"));
+        buf_putc(output, '\n');
+    }
+}
+
+void asmgen(Module* m, Buf* output) {
+    int i;
+
+    buf_puts(output, "    .text\n");
+    for (i=0; i<list_len(m->decls); ++i)
+        if (m->decls[i]->kind == Dfun && !m->decls[i]->import)
+            asmgen_fun(m->decls[i], output);
+    list_append(inits, cgen_declname(m->init));
+
+    if (m->main) {
+        buf_puts(output, "    .globl main\n    .type main, @function\nmain:\n"
+                         "    pushq %rbp\n    movq %rsp, %rbp\n"
+                         "    movl %edi, __blaze_argc(%rip)\n"
+                         "    movq %rsi, __blaze_argv(%rip)\n");
+        for (i=0; i<list_len(inits); ++i)
+            buf_printf(output, "    call %s\n", inits[i]);
+        call_decl(m->main, output);
+        buf_puts(output, "    popq %rbp\n    ret\n\n");
+        list_free(inits);
+        inits = NULL;
+    }
+
+    buf_putsz(output, strings.str, strings.len);
+    buf_free(&strings);
+    buf_puts(output, "    .data\n");
+    if (m->main)
+        buf_puts(output, "    .globl __blaze_argc\n    .balign 4\n__blaze_argc:\n"
+                         "    .zero 4\n    .globl __blaze_argv\n    .balign 8\n"
+                         "__blaze_argv:\n    .zero 8\n");
+    for (i=0; i<list_len(m->decls); ++i)
+        if (m->decls[i]->kind == Dglobal && !m->decls[i]->import)
+            asmgen_global(m->decls[i], output);
+    buf_puts(output, "    .section .note.GNU-stack,\"\",@progbits\n");
+    fun_id = 0;
+}
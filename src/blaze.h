@@ -24,6 +24,7 @@
 #define BUILTINS "builtins"
 
 typedef struct String String;
+typedef struct Buf Buf;
 typedef struct Config Config;
 typedef struct Location Location;
 typedef struct Type Type;
@@ -91,6 +92,21 @@ void string_mergec(String* base, char rhs);
 void string_merges(String* base, const char* rhs);
 
 
+// Output buffers, which grow geometrically and are written out in one go.
+struct Buf {
+    char* str;
+    size_t len, cap;
+};
+
+void buf_putsz(Buf* b, const char* s, size_t len);
+void buf_puts(Buf* b, const char* s);
+void buf_putc(Buf* b, char c);
+// Supports %s, %c, %d, %zu, and %%.
+void buf_printf(Buf* b, const char* fmt, ...);
+int buf_write(Buf* b, const char* path);
+void buf_free(Buf* b);
+
+
 // Lists.
 #define list_cat2(a,b) a##b
 #define list_cat(a,b) list_cat2(a,b)
@@ -136,6 +152,8 @@ struct GData {
     List(Decl*) sons;
     int done; // Has code for the item been generated yet? (Not always set!)
     int put_typedef; // Similar to done.
+    int first, last; // The instructions a temporary is live between.
+    int folded; // Is a temporary's value written where it's used instead?
 };
 
 struct Type {
@@ -158,8 +176,13 @@ struct Type {
         struct {
             Type** constr;
             Node* n;
+            Type* ref; // The read-only reference to it, once needed (see igen).
         }; // Tstruct
-        int mut; // Tptr
+        struct {
+            int mut;
+            int cref; // Is this a read-only reference (a const pointer in C)?
+        }; // Tptr
+        int byval; // Tfun: are structs passed by value, as C does?
     };
     String* name;
     // Tfun: ret, args...
@@ -185,6 +208,8 @@ enum Flags {
     Fstc =1<<9 , // Is the var a constant method/constructor of a parent struct?
     Farg =1<<10, // Is the var an argument?
     Fmvm =1<<11, // Does this method require a mutable this?
+    Fmove=1<<12, // Does the IR move its source instead of copying it?
+    Fnoalias=1<<13, // Can the pointer argument be restrict in C?
 };
 
 typedef enum Op {
@@ -362,6 +387,7 @@ struct Module {
     List(Type*) types;
     List(Module*) imports;
     Decl* main, *init;
+    uint64_t hash; // Of the C header and the ones it includes (see cgen).
     GData d;
 };
 
@@ -389,17 +415,23 @@ struct Decl {
         }; // Dfun
     };
     String* name, *import, *exportc;
+    // Dglobal: the static initializer found by iopt, if any.
+    String* value;
+    Location* loc; // Where the decl is in the source (NULL for initializers).
     // The variable associated with the decl.
     Var* v;
     // The decl's module.
     Module* m;
+    // Fmemb: the struct the decl is a member of.
+    Type* parent;
     int flags;
     int export;
     int labels;
+    int ids; // The id the next variable the decl owns gets.
 };
 
 struct Var {
-    int id; // A unique id given to each variable.
+    int id; // An id unique among the variables of the same owner.
     String* name; // NULL if temporary.
     int uses; // Number of uses.
     Decl* owner;
@@ -414,7 +446,6 @@ struct Var {
     List(Var**) av; // Attribute variables.
     List(Var*) iv; // Index variables.
     Var* base; // If either of the above are truthy, this is the base var.
-    int no_destr; // Avoid calling the destructor?
     List(Instr*) destr; // The Idel instructions.
     GData d;
 };
@@ -450,11 +481,15 @@ struct Instr {
     int label; // An optional label to jump to.
     String* s;
     int flags;
+    Location* loc; // Icjmp: the statement it came from, for profiles.
 };
 
 extern Instr magic; // Used to represent "magic" vars.
 
 Var* var_new(Decl* owner, Instr* ir, Type* type, String* name);
+// Returns the function var a call's target var refers to.
+Var* call_target(Var* v);
+int movable(Decl* d, Var* v);
 void var_dump(Var* var);
 void var_free(Var* var);
 
@@ -466,14 +501,58 @@ void decl_free(Decl* d);
 
 Module* igen(Node* n);
 void iopt(Module* m);
+extern int opt_level; // Passes above this -O level don't run.
+// Marks the functions in mods that are pure or const in C's sense.
+void infer_purity(List(Module*) mods);
+// Marks the pointer arguments in mods that can't alias (needs infer_purity).
+void infer_restrict(List(Module*) mods);
+// Keeps the given pass from running. Returns 0 if there's no such pass.
+int iopt_disable(const char* name);
+void iopt_pass_names(FILE* f);
+// Prints how long each pass took and what it did to the instructions.
+void iopt_dump_stats(FILE* f);
 void module_dump(Module* m);
 void module_free(Module* m);
 
 
-void cgen(Module* m, FILE* output);
+// The directory cgen caches the C of each function in, or NULL.
+extern const char* cgen_cache;
+// Deletes the entries in cgen_cache the modules generated so far didn't use.
+void cgen_prune_cache();
+// How many parts cgen splits m into.
+int cgen_parts(Module* m);
+/* Generates the C for m: output[0] is its header and output[1..parts] are the
+   C files. The headers of m's imports must be generated first. */
+void cgen(Module* m, Buf* output, int parts);
+// Generates the C that writes the profile of the modules generated so far.
+void cgen_profile(Buf* output);
 void cgen_free(Module* m);
+// The name of what d declares in C.
+const char* cgen_declname(Decl* d);
+
+// Write x86-64 assembly instead of C?
+extern int native;
+void asmgen(Module* m, Buf* output);
 
 
 void build(const char* tgt, Config config, List(Module*) mods);
 
+
+#define PROFILE "blaze.profile"
+
+// Where programs built with --profile-generate write their profile, or NULL.
+extern const char* profile_out;
+// Reads the profile given to --profile-use.
+int profile_load(const char* path);
+void profile_free();
+// Returns "module:line:column", which identifies profile counters.
+String* profile_key(Location* loc);
+int profile_used();
+// These return 0 if the profile has no counts for loc.
+int profile_calls(Location* loc, unsigned long* calls);
+// Counts how often a branch's condition was true and false.
+int profile_branch(Location* loc, unsigned long* on_true, unsigned long* on_false);
+// Is a function that was called this many times one of the hot ones?
+int profile_hot(unsigned long calls);
+
 #endif
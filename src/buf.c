@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "blaze.h"
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MINCAP 4096
+
+static char* reserve(Buf* b, size_t len) {
+    if (b->len+len > b->cap) {
+        b->cap = b->cap ? b->cap*2 : MINCAP;
+        if (b->cap < b->len+len) b->cap = b->len+len;
+        b->str = ralloc(b->str, b->cap);
+    }
+    return b->str+b->len;
+}
+
+void buf_putsz(Buf* b, const char* s, size_t len) {
+    memcpy(reserve(b, len), s, len);
+    b->len += len;
+}
+
+void buf_puts(Buf* b, const char* s) { buf_putsz(b, s, strlen(s)); }
+
+void buf_putc(Buf* b, char c) {
+    *reserve(b, 1) = c;
+    ++b->len;
+}
+
+static void putu(Buf* b, unsigned long x, int neg) {
+    char buf[24], *p = buf+sizeof(buf);
+    do *--p = '0' + x%10; while (x /= 10);
+    if (neg) *--p = '-';
+    buf_putsz(b, p, buf+sizeof(buf)-p);
+}
+
+void buf_printf(Buf* b, const char* fmt, ...) {
+    const char* p;
+    long d;
+    va_list args;
+    va_start(args, fmt);
+    while ((p = strchr(fmt, '%'))) {
+        buf_putsz(b, fmt, p-fmt);
+        switch (*++p) {
+        case 's': buf_puts(b, va_arg(args, const char*)); break;
+        case 'c': buf_putc(b, va_arg(args, int)); break;
+        case 'd':
+            d = va_arg(args, int);
+            putu(b, d < 0 ? -(unsigned long)d : d, d < 0);
+            break;
+        case 'z':
+            bassert(*++p == 'u', "unknown format %%z%c", *p);
+            putu(b, va_arg(args, size_t), 0);
+            break;
+        case '%': buf_putc(b, '%'); break;
+        default: fatal("unknown format %%%c", *p);
+        }
+        fmt = p+1;
+    }
+    buf_puts(b, fmt);
+    va_end(args);
+}
+
+int buf_write(Buf* b, const char* path) {
+    size_t done = 0;
+    ssize_t n;
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1) {
+        fprintf(stderr, "error opening %s for writing: %s\n", path,
+                strerror(errno));
+        return 0;
+    }
+
+    while (done < b->len) {
+        n = write(fd, b->str+done, b->len-done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            fprintf(stderr, "error writing %s: %s\n", path, strerror(errno));
+            close(fd);
+            return 0;
+        }
+        done += n;
+    }
+    if (close(fd) == -1) {
+        fprintf(stderr, "error writing %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+void buf_free(Buf* b) {
+    free(b->str);
+    b->str = NULL;
+    b->len = b->cap = 0;
+}
@@ -13,19 +13,72 @@ static FILE* open_write(const char* path) {
     return f;
 }
 
-static int write_module(Module* m) {
-    FILE* f;
+// Is the file at path already exactly what's in b?
+static int unchanged(const char* path, Buf* b) {
+    size_t len;
+    char* text;
+    int res;
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    text = readall(f, &len);
+    fclose(f);
+    res = text && len == b->len && !memcmp(text, b->str, len);
+    free(text);
+    return res;
+}
 
-    m->d.cname = string_new(".blaze/");
-    string_merge(m->d.cname, m->name);
-    string_merges(m->d.cname, ".c");
+// Leaves the file alone if it's unchanged so its modification time stays the same.
+static int write_file(const char* path, Buf* b) {
+    return unchanged(path, b) || buf_write(b, path);
+}
 
-    f = open_write(m->d.cname->str);
-    if (!f) return 0;
+/* Writes the header .blaze/<module>.h and .blaze/<module>.c, or if the module
+   is big enough to be split, the parts .blaze/<module>-<k>.c. The C files, or
+   .blaze/<module>.s when building natively, are added to files. Imports are
+   written first since their headers are needed. */
+static int write_module(Module* m, List(String*)* files) {
+    char num[32];
+    int i, res = 1, parts = native ? 1 : cgen_parts(m);
+    Buf* b;
+    String* s;
+
+    if (m->d.done) return 1;
+    m->d.done = 1;
+    for (i=0; i<list_len(m->imports); ++i)
+        if (!write_module(m->imports[i], files)) return 0;
+
+    b = calloc(parts+1, sizeof(Buf));
+    bassert(b, "out of memory");
+    if (native) asmgen(m, &b[1]);
+    else cgen(m, b, parts);
+    for (i=native ? 1 : 0; i<=parts; ++i) {
+        s = string_new(".blaze/");
+        string_merge(s, m->name);
+        if (i && parts > 1) {
+            snprintf(num, sizeof(num), "-%d", i);
+            string_merges(s, num);
+        }
+        string_merges(s, !i ? ".h" : native ? ".s" : ".c");
+        res = res && write_file(s->str, &b[i]);
+        if (i) list_append(*files, s);
+        else string_free(s);
+    }
 
-    cgen(m, f);
-    fclose(f);
-    return 1;
+    for (i=0; i<=parts; ++i) buf_free(&b[i]);
+    free(b);
+    return res;
+}
+
+// Writes .blaze/__blaze_profile.c, which saves the profile at exit, to files.
+static int write_profile(List(String*)* files) {
+    Buf b = {NULL, 0, 0};
+    String* s = string_new(".blaze/__blaze_profile.c");
+    int res;
+    cgen_profile(&b);
+    res = write_file(s->str, &b);
+    buf_free(&b);
+    list_append(*files, s);
+    return res;
 }
 
 static void write_compiler_flags(Config config, FILE* f) {
@@ -36,7 +89,7 @@ static void write_compiler_flags(Config config, FILE* f) {
     fputc('\n', f);
 }
 
-static int write_lightbuild(const char* tgt, Config config, List(Module*) mods) {
+static int write_lightbuild(const char* tgt, Config config, List(String*) files) {
     int i;
     FILE* f = open_write(".blaze/build");
     if (!f) return 0;
@@ -47,8 +100,8 @@ static int write_lightbuild(const char* tgt, Config config, List(Module*) mods)
     fprintf(f, "T%s\n", tgt);
     fputs("O-o\nX-o\n", f);
 
-    fprintf(f, ":%zu\n", list_len(mods));
-    for (i=0; i<list_len(mods); ++i) fprintf(f, "%s\n", mods[i]->d.cname->str);
+    fprintf(f, ":%zu\n", list_len(files));
+    for (i=0; i<list_len(files); ++i) fprintf(f, "%s\n", files[i]->str);
     fclose(f);
     return 1;
 }
@@ -56,23 +109,26 @@ static int write_lightbuild(const char* tgt, Config config, List(Module*) mods)
 void build(const char* tgt, Config config, List(Module*) mods) {
     int i;
     String* s = NULL;
+    List(String*) files = NULL;
     if (!exists(".blaze") && !pmkdir(".blaze")) return;
+    if (exists(".blaze/cache") || pmkdir(".blaze/cache")) cgen_cache = ".blaze/cache";
 
     for (i=0; i<list_len(mods); ++i)
-        if (!write_module(mods[i])) goto end;
+        if (!write_module(mods[i], &files)) goto end;
+    if (profile_out && !write_profile(&files)) goto end;
 
-    if (!write_lightbuild(tgt, config, mods)) goto end;
+    cgen_prune_cache();
+    if (!write_lightbuild(tgt, config, files)) goto end;
 
     s = string_new(config.lightbuild);
     string_merges(s, " .blaze/build");
     if (system(s->str)) fputs("C compilation failed!\n", stderr);
 
 end:
-    for (i=0; i<list_len(mods); ++i) {
-        cgen_free(mods[i]);
-        string_free(mods[i]->d.cname);
-    }
+    for (i=0; i<list_len(mods); ++i) cgen_free(mods[i]);
     cgen_free(NULL);
+    for (i=0; i<list_len(files); ++i) string_free(files[i]);
+    list_free(files);
 
     if (s) string_free(s);
 }
@@ -3,13 +3,33 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include "blaze.h"
+#include <ctype.h>
+#include <dirent.h>
 
 const char* typenames[] = {"int", "unsigned char", "char", "unsigned long",
                            "int"};
-int type_id=0;
-
 #define CNAME(x) ((x)?(x)->d.cname->str:"void")
 
+// Appends a local or field name to s, spelling the operators C doesn't allow.
+static void merge_name(String* s, String* name) {
+    if (!strcmp(name->str, "[]")) string_merges(s, "index");
+    else if (!strcmp(name->str, "&[]")) string_merges(s, "aindex");
+    else string_merge(s, name);
+}
+
+/* Appends name to s with anything but letters and digits, _ included, escaped
+   as _ and two hex digits. That leaves __ free to separate the parts of a
+   name, and different names never give the same identifier. */
+static void mangle(String* s, const char* name) {
+    char buf[4];
+    for (; *name; ++name)
+        if (isalnum((unsigned char)*name)) string_mergec(s, *name);
+        else {
+            snprintf(buf, sizeof(buf), "_%02x", (unsigned char)*name);
+            string_merges(s, buf);
+        }
+}
+
 static void generate_basename(char p, GData* d, String* name, int id) {
     char buf[1024];
     if (d->cname) return;
@@ -18,19 +38,71 @@ static void generate_basename(char p, GData* d, String* name, int id) {
     string_merges(d->cname, buf);
     if (name) {
         string_mergec(d->cname, '_');
-        if (!strcmp(name->str, "[]")) string_merges(d->cname, "$index");
-        else if (!strcmp(name->str, "&[]")) string_merges(d->cname, "$aindex");
-        else string_merge(d->cname, name);
+        merge_name(d->cname, name);
+    }
+}
+
+// Returns how a function type is written in C, as its typedef spells it.
+static String* signature(Type* t) {
+    String* res = string_new(CNAME(t->sons[0]));
+    int i;
+    string_mergec(res, '(');
+    for (i=1; i<list_len(t->sons); ++i) {
+        if (i > 1) string_merges(res, ", ");
+        // Struct arguments are passed by reference (see igen_func).
+        if (t->sons[i]->kind == Tstruct && !t->byval) string_merges(res, "const ");
+        string_merge(res, t->sons[i]->d.cname);
+        if (t->sons[i]->kind == Tstruct && !t->byval) string_mergec(res, '*');
     }
+    string_mergec(res, ')');
+    return res;
 }
 
+// The signatures of the function typedefs named so far, by name.
+static DSHtab* fun_names = NULL;
+
+/* Names only depend on what they name, so a module's C doesn't change because
+   another one did: structs are named after their module, and function types
+   after a hash of their signature (identical ones share one typedef, see
+   cgen_typedef; if two signatures have the same hash, the later one gets a
+   number). Decls are named the same way in generate_declname, with __
+   separating the parts of the name. */
 static void generate_typename(Type* t) {
+    char buf[32];
+    int i, k;
+    String* sig, *other;
     if (t->kind == Tbuiltin) t->d.cname = string_new(typenames[t->bkind]);
     else if (t->kind == Tptr) {
         generate_typename(t->sons[0]);
-        t->d.cname = string_clone(t->sons[0]->d.cname);
+        t->d.cname = string_new(t->cref ? "const " : "");
+        string_merge(t->d.cname, t->sons[0]->d.cname);
         string_mergec(t->d.cname, '*');
-    } else generate_basename('t', &t->d, t->name, type_id++);
+    } else if (t->d.cname) return;
+    else if (t->kind == Tstruct) {
+        t->d.cname = string_new("t_");
+        mangle(t->d.cname, t->n->loc.module);
+        string_merges(t->d.cname, "__");
+        mangle(t->d.cname, t->name->str);
+    } else {
+        for (i=0; i<list_len(t->sons); ++i)
+            if (t->sons[i]) generate_typename(t->sons[i]);
+        sig = signature(t);
+        if (!fun_names) fun_names = ds_hnew((DSHashFn)strhash, (DSCmpFn)streq);
+        for (k=0;; ++k) {
+            if (k) snprintf(buf, sizeof(buf), "t%08"PRIx32"_%d", strhash(sig), k);
+            else snprintf(buf, sizeof(buf), "t%08"PRIx32, strhash(sig));
+            t->d.cname = string_new(buf);
+            other = ds_hget(fun_names, t->d.cname);
+            if (!other) {
+                ds_hput(fun_names, string_clone(t->d.cname), sig);
+                break;
+            } else if (streq(other, sig)) {
+                string_free(sig);
+                break;
+            }
+            string_free(t->d.cname);
+        }
+    }
 }
 
 static void generate_argname(Var* v) {
@@ -80,13 +152,54 @@ static void generate_varname(Var* v) {
 
 static void generate_declname(Decl* d) {
     static const char prefixes[] = "fg";
+    char buf[32];
+    int i, k = 0;
+    String* s;
 
+    if (d->v->d.cname) return;
     if (d->import) d->v->d.cname = string_clone(d->import);
     else if (d->exportc) d->v->d.cname = string_clone(d->exportc);
-    else generate_basename(prefixes[d->kind], &d->v->d, d->v->name, d->v->id);
+    // Fields only need to be unique within their struct.
+    else if (d->parent && !(d->v->flags & Fstc)) {
+        d->v->d.cname = string_new("g_");
+        merge_name(d->v->d.cname, d->name);
+    } else {
+        s = d->v->d.cname = string_newz(&prefixes[d->kind], 1);
+        string_mergec(s, '_');
+        mangle(s, d->m->name->str);
+        if (d->parent) {
+            string_merges(s, "__");
+            mangle(s, d->parent->name->str);
+        }
+        if (!d->name) return;
+        string_merges(s, "__");
+        mangle(s, d->name->str);
+        // Overloads are numbered in the order they're declared.
+        for (i=0; i<list_len(d->m->decls) && d->m->decls[i] != d; ++i)
+            if (d->m->decls[i]->parent == d->parent && d->m->decls[i]->name &&
+                streq(d->m->decls[i]->name, d->name)) ++k;
+        if (k) {
+            snprintf(buf, sizeof(buf), "__%d", k);
+            string_merges(s, buf);
+        }
+    }
+}
+
+const char* cgen_declname(Decl* d) {
+    generate_declname(d);
+    return CNAME(d->v);
 }
 
-static void cgen_typedef(Type* t, FILE* output) {
+// The function typedefs written to the module being generated, by name.
+static DSHtab* fun_typedefs = NULL;
+
+/* Typedefs can't be repeated in C99, and a type can be used by several of the
+   headers a file includes, so each one is guarded by a macro. */
+static void guard(Type* t, Buf* output) {
+    buf_printf(output, "#ifndef %s\n#define %s %s\n", CNAME(t), CNAME(t), CNAME(t));
+}
+
+static void cgen_typedef(Type* t, Buf* output) {
     int i;
     bassert(t, "expected non-null type");
     if (t->d.put_typedef || t->d.done) return;
@@ -97,41 +210,61 @@ static void cgen_typedef(Type* t, FILE* output) {
     case Tany: fatal("unexpected type kind Tany");
     case Tbuiltin: case Tptr: break;
     case Tfun:
-        fprintf(output, "typedef %s", CNAME(t->sons[0]));
-        fprintf(output, " (*%s)(", CNAME(t));
+        // Each signature has its own name (see generate_typename).
+        if (ds_hget(fun_typedefs, t->d.cname)) break;
+        ds_hput(fun_typedefs, t->d.cname, t);
+        guard(t, output);
+        buf_printf(output, "typedef %s", CNAME(t->sons[0]));
+        buf_printf(output, " (*%s)(", CNAME(t));
         for (i=1; i<list_len(t->sons); ++i) {
-            if (i > 1) fputs(", ", output);
-            fputs(CNAME(t->sons[i]), output);
+            if (i > 1) buf_puts(output, ", ");
+            // Struct arguments are passed by reference (see igen_func).
+            if (t->sons[i]->kind == Tstruct && !t->byval)
+                buf_printf(output, "const %s*", CNAME(t->sons[i]));
+            else buf_puts(output, CNAME(t->sons[i]));
         }
-        fputs(");\n", output);
+        buf_puts(output, ");\n#endif\n");
         break;
     case Tstruct:
-        fprintf(output, "typedef struct %s %s;\n", CNAME(t), CNAME(t));
+        guard(t, output);
+        buf_printf(output, "typedef struct %s %s;\n#endif\n", CNAME(t), CNAME(t));
         break;
     }
     t->d.put_typedef = 1;
 }
 
-static void cgen_decl0(Decl* d, FILE* output, int external);
+static void cgen_decl0(Decl* d, Buf* output, int external);
+
+// The module being generated, if its functions are split across parts.
+static Module* split = NULL;
 
-static void cgen_typeimpl(Type* t, FILE* output) {
+static void cgen_typeimpl(Type* t, Buf* output) {
     int i;
 
     if (t->kind != Tstruct || t->d.done) return;
-    fprintf(output, "struct %s {\n", CNAME(t));
+    buf_printf(output, "struct %s {\n", CNAME(t));
     for (i=0; i<list_len(t->d.sons); ++i) {
         Decl* d = t->d.sons[i];
         if (d->kind != Dglobal) continue;
-        fputs("    ", output);
+        buf_puts(output, "    ");
         cgen_decl0(d, output, 0);
     }
-    fputs("};\n", output);
+    buf_puts(output, "};\n");
     t->d.done = 1;
 }
 
+// Is v reached through a read-only reference?
+static int via_cref(Var* v) {
+    for (; v; v = v->base)
+        if (v->deref && v->base->type && v->base->type->kind == Tptr &&
+            v->base->type->cref) return 1;
+    return 0;
+}
+
 #define HAS_COPY(v) ((v)->type && (v)->type->kind == Tstruct && \
                      (v)->type->n->magic[Mcopy])
-#define RADDR(vr) ((vr)->owner->v == (vr) && (vr)->owner->ra)
+#define RADDR(vr) (call_target(vr)->owner->v == call_target(vr) &&\
+                   call_target(vr)->owner->ra)
 
 static const char* copy(Var* v) {
     return HAS_COPY(v) ? CNAME(v->type->n->magic[Mcopy]->overloads[0]->n->v) : "";
@@ -141,26 +274,115 @@ static const char* copy_addr(Var* v) {
     return HAS_COPY(v) ? "&" : "";
 }
 
-static void cgen_set(Var* dst, int dstaddr, Var* src, FILE* output) {
+static void cgen_set(Var* dst, int dstaddr, Var* src, Buf* output) {
     if (HAS_COPY(src) && src->type->n->magic[Mcopy]->overloads[0]->n->d->ra)
-        fprintf(output, "%s(%s%s, %s%s)", copy(src), dstaddr ? "" : "&",
-                        CNAME(dst), copy_addr(src), CNAME(src));
+        buf_printf(output, "%s(%s%s, %s%s)", copy(src), dstaddr ? "" : "&",
+                           CNAME(dst), copy_addr(src), CNAME(src));
     else
-        fprintf(output, "%s%s = %s(%s%s)", dstaddr ? "*" : "", CNAME(dst),
-                        copy(src), copy_addr(src), CNAME(src));
+        buf_printf(output, "%s%s = %s(%s%s)", dstaddr ? "*" : "", CNAME(dst),
+                           copy(src), copy_addr(src), CNAME(src));
+}
+
+// The functions and branches of the module being generated that get profiling
+// counters, in the order of their counters.
+static List(Location*) call_locs = NULL;
+static List(Location*) branch_locs = NULL;
+
+// Returns the value a branch's condition usually has, or -1 if it varies.
+static int expect(Instr* ir) {
+    unsigned long t, f;
+    if (!profile_branch(ir->loc, &t, &f) || t+f < 16) return -1;
+    if (t >= (t+f) / 10 * 9) return 1;
+    if (f >= (t+f) / 10 * 9) return 0;
+    return -1;
+}
+
+// Writes the value of an instruction that computes one.
+static void cgen_expr(Instr* ir, Buf* output) {
+    int i;
+    switch (ir->kind) {
+    case Icall:
+        buf_printf(output, "%s(", CNAME(ir->v[0]));
+        // The return address comes first, then this (see cgen_proto).
+        if (RADDR(ir->v[0])) {
+            buf_printf(output, "&(%s)", CNAME(ir->dst));
+            if (list_len(ir->v) > 1 || ir->v[0]->flags & Fstc) buf_puts(output, ", ");
+        }
+
+        if (ir->v[0]->flags & Fstc && ir->v[0]->base) {
+            buf_printf(output, "&(%s", CNAME(ir->v[0]->base));
+            for (i=0; i<list_len(ir->v[0]->av)-1; ++i)
+                buf_printf(output, ".%s", CNAME(*ir->v[0]->av[i]));
+            buf_putc(output, ')');
+            if (list_len(ir->v) > 1) buf_puts(output, ", ");
+        }
+
+        for (i=1; i<list_len(ir->v); ++i) {
+            if (i > 1) buf_puts(output, ", ");
+            buf_puts(output, CNAME(ir->v[i]));
+        }
+        buf_putc(output, ')');
+        break;
+    case Iaddr:
+        // Taking a mutable address of a member of a const this needs a cast.
+        if (!ir->dst->type->cref && via_cref(ir->v[0]))
+            buf_printf(output, "(%s)", CNAME(ir->dst->type));
+        if (ir->v[0]->deref) buf_printf(output, "%s", CNAME(ir->v[0]->base));
+        else buf_printf(output, "&%s", CNAME(ir->v[0]));
+        break;
+    case Icast:
+        bassert(ir->dst, "cast without destination");
+        buf_printf(output, "(%s)(%s)", CNAME(ir->dst->type), CNAME(ir->v[0]));
+        break;
+    case Iop:
+        buf_printf(output, "%s %s %s", CNAME(ir->v[0]), op_strings[ir->op],
+                   CNAME(ir->v[1]));
+        break;
+    case Iint:
+        buf_puts(output, ir->s->str);
+        break;
+    default: fatal("unexpected ir kind %d", ir->kind);
+    }
+}
+
+static void indent(int depth, Buf* output) {
+    while (depth--) buf_puts(output, "    ");
+}
+
+static void count_branch(Instr* ir, int depth, Buf* output) {
+    if (!profile_out || !ir->loc) return;
+    indent(depth, output);
+    buf_printf(output, "++__blaze_branches[%zu][!(%s)];\n", list_len(branch_locs),
+               CNAME(ir->v[0]));
+    list_append(branch_locs, ir->loc);
+}
+
+// Writes a branch's condition, with the way the profile says it usually goes.
+static void cgen_test(Instr* ir, Buf* output) {
+    Var* v = ir->v[0];
+    int e = expect(ir);
+    if (e != -1) buf_printf(output, "__builtin_expect(!!(%s), %d)", CNAME(v), e);
+    else if (v->d.folded && v->ir->kind != Iint)
+        buf_putsz(output, CNAME(v)+1, v->d.cname->len-2);
+    else buf_puts(output, CNAME(v));
 }
 
-static void cgen_ir(Decl* d, Instr* ir, FILE* output) {
+static void cgen_ir(Decl* d, Instr* ir, int depth, Buf* output) {
     int i;
     for (i=0; i<list_len(ir->v); ++i) generate_varname(ir->v[i]);
     // The IR was optimized out by iopt.
     if (ir->kind == Inull || (ir->kind == Iaddr && ir->dst->uses == 0) ||
         (ir->kind == Inew && !ir->dst->type)) return;
+    // The value is written where it's used (see fold_temps).
+    if (ir->dst && ir->dst->d.folded) return;
+    // String literals are initialized statically by cgen_decl1.
+    if (ir->kind == Istr) return;
 
-    fputs("    ", output);
+    if (ir->kind == Icjmp) count_branch(ir, depth, output);
+    indent(depth, output);
     if (ir->dst && ir->dst->type && ir->kind != Iconstr && ir->kind != Inew &&
         ir->kind != Istr && !(ir->kind == Icall && RADDR(ir->v[0])))
-        fprintf(output, "%s = ", CNAME(ir->dst));
+        buf_printf(output, "%s = ", CNAME(ir->dst));
 
     switch (ir->kind) {
     case Inull: fatal("unexpected ir kind Inull");
@@ -168,141 +390,647 @@ static void cgen_ir(Decl* d, Instr* ir, FILE* output) {
         if (ir->v) {
             /* Only move local variables and rvalues (which should now be locals
                anyway). */
-            int do_move = ir->v[0]->owner == d && !(ir->v[0]->flags & Farg);
-            if (do_move)
-                fprintf(output, "%s%s = %s", d->ra ? "*" : "", CNAME(d->rv),
-                        CNAME(ir->v[0]));
+            if (movable(d, ir->v[0]))
+                buf_printf(output, "%s%s = %s", d->ra ? "*" : "", CNAME(d->rv),
+                           CNAME(ir->v[0]));
             else cgen_set(d->rv, d->ra, ir->v[0], output);
-            ir->v[0]->no_destr = do_move;
         }
         break;
     case Icjmp:
-        fprintf(output, "if (!(%s)) goto L%d", CNAME(ir->v[0]), ir->label);
+        buf_puts(output, "if (!(");
+        cgen_test(ir, output);
+        buf_printf(output, ")) goto L%d", ir->label);
         break;
     case Ijmp:
-        fprintf(output, "goto L%d", ir->label);
+        buf_printf(output, "goto L%d", ir->label);
         break;
     case Ilabel:
-        fprintf(output, "L%d:", ir->label);
+        buf_printf(output, "L%d:", ir->label);
         break;
     case Iset:
-        cgen_set(ir->v[0], 0, ir->v[1], output);
+        if (ir->flags & Fmove)
+            buf_printf(output, "%s = %s", CNAME(ir->v[0]), CNAME(ir->v[1]));
+        else cgen_set(ir->v[0], 0, ir->v[1], output);
         break;
     case Inew:
         cgen_set(ir->dst, 0, ir->v[0], output);
         break;
     case Idel:
-        if (ir->v[1]->type && !ir->v[1]->no_destr)
-            fprintf(output, "%s(&(%s));\n", CNAME(ir->v[0]), CNAME(ir->v[1]));
+        if (ir->v[1]->type)
+            buf_printf(output, "%s(&(%s));\n", CNAME(ir->v[0]), CNAME(ir->v[1]));
         break;
     case Iconstr:
-        fprintf(output, "%s(&(%s)", CNAME(ir->v[0]), CNAME(ir->dst));
+        buf_printf(output, "%s(&(%s)", CNAME(ir->v[0]), CNAME(ir->dst));
         for (i=1; i<list_len(ir->v); ++i)
-            fprintf(output, ", %s", CNAME(ir->v[i]));
-        fputc(')', output);
+            buf_printf(output, ", %s", CNAME(ir->v[i]));
+        buf_putc(output, ')');
         break;
-    case Icall:
-        fprintf(output, "%s(", CNAME(ir->v[0]));
-        if (ir->v[0]->flags & Fstc && ir->v[0]->base) {
-            fprintf(output, "&(%s", CNAME(ir->v[0]->base));
-            for (i=0; i<list_len(ir->v[0]->av)-1; ++i)
-                fprintf(output, ".%s", CNAME(*ir->v[0]->av[i]));
-            fputc(')', output);
-            if (list_len(ir->v) > 1) fputs(", ", output);
-        }
-
-        if (RADDR(ir->v[0])) {
-            fprintf(output, "&(%s)", CNAME(ir->dst));
-            if (list_len(ir->v) > 1) fputs(", ", output);
-        }
-
-        for (i=1; i<list_len(ir->v); ++i) {
-            if (i > 1) fputs(", ", output);
-            fputs(CNAME(ir->v[i]), output);
-        }
-        fputc(')', output);
-        break;
-    case Iaddr:
-        if (ir->v[0]->deref) fprintf(output, "%s", CNAME(ir->v[0]->base));
-        else fprintf(output, "&%s", CNAME(ir->v[0]));
-        break;
-    case Icast:
-        bassert(ir->dst, "cast without destination");
-        fprintf(output, "(%s)(%s)", CNAME(ir->dst->type), CNAME(ir->v[0]));
-        break;
-    case Iop:
-        fprintf(output, "%s %s %s", CNAME(ir->v[0]), op_strings[ir->op],
-                CNAME(ir->v[1]));
-        break;
-    case Iint:
-        fputs(ir->s->str, output);
-        break;
-    case Istr:
-        bassert(ir->dst->type == builtins[Bstr]->type,
-                "string literal with non-string type");
-        fprintf(output, "%s(&(%s), \"%s\", %zu)",
-                CNAME(ir->dst->type->n->magic[Mnew]->overloads[0]->n->v),
-                CNAME(ir->dst), ir->s->str, ir->s->len);
+    case Icall: case Iaddr: case Icast: case Iop: case Iint:
+        cgen_expr(ir, output);
         break;
+    case Istr: fatal("unexpected ir kind Istr");
     }
-    fputs(";\n", output);
+    buf_puts(output, ";\n");
 }
 
-static void cgen_proto(Decl* d, FILE* output) {
+// Functions with at most this many instructions are worth inlining in C.
+#define SMALL 16
+
+static int small(Decl* d) {
+    int i, n = 0;
+    for (i=0; i<list_len(d->sons); ++i) if (d->sons[i]->kind != Inull) ++n;
+    return n <= SMALL;
+}
+
+// Is d left out of its module's header?
+static int private(Decl* d) {
+    return d->kind == Dfun && !d->exportc && !d->import && !d->export;
+}
+
+static void cgen_proto(Decl* d, Buf* output) {
     int i;
 
     bassert(d->kind == Dfun, "unexpected decl kind %d", d->kind);
-    if (!d->exportc && !d->import && !d->export) fputs("static ", output);
-    fprintf(output, "%s %s(", d->v->type && !d->ra ? CNAME(d->v->type->sons[0])
-                                                   : "void",
-            CNAME(d->v));
+    // The parts of a split module call each other.
+    if (private(d) && d->m != split)
+        buf_puts(output, small(d) ? "static inline " : "static ");
+    // Void functions that did nothing would just be removed.
+    if (d->v->type && d->v->type->sons[0] && !d->ra && d->flags & Fpure &&
+        !d->import)
+        buf_puts(output, d->flags & Fcst ? "__attribute__((const)) "
+                                         : "__attribute__((pure)) ");
+    buf_printf(output, "%s %s(", d->v->type && !d->ra ? CNAME(d->v->type->sons[0])
+                                                      : "void",
+               CNAME(d->v));
     if (d->ra) {
         generate_varname(d->rv);
-        fprintf(output, "%s %s", CNAME(d->rv->type), CNAME(d->rv));
+        buf_printf(output, "%s %s%s", CNAME(d->rv->type),
+                   d->rv->flags & Fnoalias ? "restrict " : "", CNAME(d->rv));
     }
     for (i=0; i<list_len(d->args); ++i) {
         generate_argname(d->args[i]);
-        if (i || d->ra) fputs(", ", output);
-        fprintf(output, "%s %s", CNAME(d->args[i]->type), CNAME(d->args[i]));
+        if (i || d->ra) buf_puts(output, ", ");
+        buf_printf(output, "%s %s%s", CNAME(d->args[i]->type),
+                   d->args[i]->flags & Fnoalias ? "restrict " : "", CNAME(d->args[i]));
     }
-    fputc(')', output);
+    buf_putc(output, ')');
 }
 
-static void cgen_decl0(Decl* d, FILE* output, int external) {
+static void cgen_decl0(Decl* d, Buf* output, int external) {
     generate_declname(d);
     switch (d->kind) {
     case Dfun:
         cgen_proto(d, output);
-        fputs(";\n", output);
+        buf_puts(output, ";\n");
         break;
     case Dglobal:
-        if (external || d->import) fputs("extern ", output);
-        fprintf(output, "%s %s;\n", CNAME(d->v->type), CNAME(d->v));
+        if (external || d->import) buf_puts(output, "extern ");
+        buf_printf(output, "%s %s", CNAME(d->v->type), CNAME(d->v));
+        if (!external && d->value) buf_printf(output, " = %s", d->value->str);
+        buf_puts(output, ";\n");
         break;
     }
 
 }
 
-static void cgen_decl1(Decl* d, FILE* output) {
+/* String literals are static strs that don't own their data (the remaining
+   members, including _owned, are zeroed), so they're never allocated or freed. */
+static void cgen_strlit(Var* v, Buf* output) {
+    bassert(v->type == builtins[Bstr]->type, "string literal with non-string type");
+    buf_printf(output, "    static const %s %s = {\"%s\", sizeof(\"%s\")-1};\n",
+               CNAME(v->type), CNAME(v), v->ir->s->str, v->ir->s->str);
+}
+
+// Can v share its C local with other temporaries?
+static int shareable(Var* v) {
+    return v->type && v->type->kind != Tstruct && v->type->d.cname && !v->name &&
+           v->ir && v->ir->kind != Istr && !v->deref && !(v->flags & Farg) &&
+           !v->d.folded;
+}
+
+static void mark_live(Var* v, int i) {
+    int j;
+    // What a folded temporary reads is read where it's used.
+    if (v->d.folded)
+        for (j=0; j<list_len(v->ir->v); ++j) mark_live(v->ir->v[j], i);
+    else if (v->ir == &magic) {
+        if (v->base) mark_live(v->base, i);
+        for (j=0; j<list_len(v->iv); ++j) mark_live(v->iv[j], i);
+    } else if (v->d.first != -1) {
+        if (v->d.first == -2 || v->d.first > i) v->d.first = i;
+        if (v->d.last < i) v->d.last = i;
+    }
+}
+
+static int by_first(const void* a, const void* b) {
+    return (*(Var**)a)->d.first - (*(Var**)b)->d.first;
+}
+
+/* Temporaries that are never live at the same time and have the same C type
+   share one C local; the others are marked done so cgen_decl1 skips them.
+   Liveness is a range of instructions, stretched over any loop it overlaps. */
+static void share_temps(Decl* d) {
+    List(Var*) temps = NULL;
+    List(Var*) slots = NULL;
+    int* labels = alloc(sizeof(int)*(d->labels+1));
+    int i, j, changed;
+
+    for (i=0; i<list_len(d->vars); ++i)
+        d->vars[i]->d.first = shareable(d->vars[i]) ? -2 : -1;
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Ilabel) labels[ir->label] = i;
+        // Anything whose address is taken may be used through it later.
+        if (ir->kind == Iaddr && !ir->v[0]->deref) {
+            Var* v = ir->v[0];
+            while (v->base && !v->deref) v = v->base;
+            if (v->ir != &magic) v->d.first = -1;
+        }
+    }
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull) continue;
+        if (ir->dst) mark_live(ir->dst, i);
+        for (j=0; j<list_len(ir->v); ++j) mark_live(ir->v[j], i);
+    }
+
+    do {
+        changed = 0;
+        for (i=0; i<list_len(d->sons); ++i) {
+            Instr* ir = d->sons[i];
+            int head = labels[ir->label];
+            if ((ir->kind != Ijmp && ir->kind != Icjmp) || head > i) continue;
+            for (j=0; j<list_len(d->vars); ++j) {
+                Var* v = d->vars[j];
+                if (v->d.first >= 0 && v->d.first < head && v->d.last >= head &&
+                    v->d.last < i) {
+                    v->d.last = i;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    for (i=0; i<list_len(d->vars); ++i)
+        if (d->vars[i]->d.first >= 0) list_append(temps, d->vars[i]);
+    if (temps) qsort(temps, list_len(temps), sizeof(Var*), by_first);
+
+    for (i=0; i<list_len(temps); ++i) {
+        Var* v = temps[i];
+        for (j=0; j<list_len(slots); ++j)
+            if (slots[j]->d.last < v->d.first &&
+                streq(slots[j]->type->d.cname, v->type->d.cname)) break;
+        if (j == list_len(slots)) {
+            list_append(slots, v);
+            continue;
+        }
+        generate_varname(slots[j]);
+        v->d.cname = string_clone(slots[j]->d.cname);
+        v->d.done = 1;
+        slots[j]->d.last = v->d.last;
+    }
+
+    list_free(temps);
+    list_free(slots);
+    free(labels);
+}
+
+// Temporaries read through a place, or written outside their instruction.
+#define UNFOLDABLE (1<<20)
+
+// Counts the reads of v and the temporaries it's indexed by in first, and
+// remembers the last one in last.
+static void count_use(Var* v, int i) {
+    int j;
+    if (v->ir == &magic) {
+        if (v->base) count_use(v->base, i);
+        for (j=0; j<list_len(v->iv); ++j) count_use(v->iv[j], i);
+    } else {
+        ++v->d.first;
+        v->d.last = i;
+    }
+}
+
+// Can the instruction at i be written where its result is used instead?
+static int foldable(Decl* d, int i) {
+    Instr* ir = d->sons[i];
+    Var* v = ir->dst, *t;
+    if (!v || v->ir != ir || v->d.first != 1 || v->d.last <= i) return 0;
+    if (!shareable(v)) return 0;
+    switch (ir->kind) {
+    case Iaddr: case Icast: case Iop: case Iint: return 1;
+    case Icall:
+        t = call_target(ir->v[0]);
+        return t->owner->v == t && !t->owner->ra && t->owner->flags & Fpure;
+    default: return 0;
+    }
+}
+
+/* Temporaries that are computed without side effects and read once, by a later
+   instruction with only other such computations in between, are written as
+   part of the expression that reads them. Run before share_temps, and
+   finish_folds after it, when the names of what they read are final. */
+static void fold_temps(Decl* d) {
+    int i, j;
+    for (i=0; i<list_len(d->vars); ++i) {
+        d->vars[i]->d.first = 0;
+        d->vars[i]->d.folded = 0;
+    }
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull) continue;
+        for (j=0; j<list_len(ir->v); ++j) {
+            Var* v = ir->v[j];
+            if (j == 0 && (ir->kind == Iset || ir->kind == Iaddr) &&
+                v->ir != &magic) v->d.first += UNFOLDABLE;
+            else count_use(v, i);
+        }
+        if (!ir->dst) continue;
+        if (ir->dst->ir == &magic) count_use(ir->dst, i);
+        else if (ir->dst->ir != ir) ir->dst->d.first += UNFOLDABLE;
+    }
+
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull || ir->kind == Ilabel || ir->kind == Ijmp) continue;
+        // The profiling counter repeats the condition.
+        if (ir->kind == Icjmp && profile_out && ir->loc) continue;
+        for (j=i-1; j>=0; --j) {
+            ir = d->sons[j];
+            if (ir->kind == Inull) continue;
+            if (!foldable(d, j) || ir->dst->d.last > i) break;
+            ir->dst->d.folded = 1;
+        }
+    }
+}
+
+static void finish_folds(Decl* d) {
+    Buf b = {NULL, 0, 0};
+    int i, j;
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull || !ir->dst || !ir->dst->d.folded) continue;
+        for (j=0; j<list_len(ir->v); ++j) generate_varname(ir->v[j]);
+        b.len = 0;
+        if (ir->kind == Iint) cgen_expr(ir, &b);
+        else {
+            buf_putc(&b, '(');
+            cgen_expr(ir, &b);
+            buf_putc(&b, ')');
+        }
+        if (ir->dst->d.cname) string_free(ir->dst->d.cname);
+        ir->dst->d.cname = string_newz(b.str, b.len);
+        ir->dst->d.done = 1;
+    }
+    buf_free(&b);
+}
+
+#undef UNFOLDABLE
+
+// How cgen_body writes a jump or label (see structure).
+enum {
+    Rgoto, // As a goto or label, if anything jumps to it.
+    Rskip, // Not at all; it jumps to the next instruction.
+    Rif, // As an if whose block ends at the label it jumps to.
+    Rendif,
+    Rloop, // As a for (;;) whose condition is tested by a later Rcond.
+    Rcond,
+    Rwhile, // As a while with the condition of the jump.
+    Rendloop // The jump back to the head of the loop.
+};
+
+static int next_instr(Decl* d, int i) {
+    while (++i < list_len(d->sons) && d->sons[i]->kind == Inull);
+    return i;
+}
+
+// Is the label at h the head of a loop as igen lowers while? If so, sets *c to
+// the jump out of it and *j to the jump back.
+static int loop_at(Decl* d, int h, int* at, int* c, int* j) {
+    int i, e;
+    for (i=h+1; i<list_len(d->sons) && d->sons[i]->kind != Icjmp; ++i)
+        if (d->sons[i]->kind == Ilabel || d->sons[i]->kind == Ijmp) return 0;
+    if (i == list_len(d->sons) || (e = at[d->sons[i]->label]) < i) return 0;
+    for (*j=e-1; *j>i && d->sons[*j]->kind == Inull; --*j);
+    if (*j == i || d->sons[*j]->kind != Ijmp ||
+        d->sons[*j]->label != d->sons[h]->label) return 0;
+    *c = i;
+    return 1;
+}
+
+// Is there any code between the head of a loop and the jump out of it?
+static int loop_test(Decl* d, int h, int c) {
+    int i;
+    if (profile_out && d->sons[c]->loc) return 1;
+    for (i=h+1; i<c; ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind != Inull && !(ir->dst && ir->dst->d.folded)) return 1;
+    }
+    return 0;
+}
+
+/* Finds the ifs and whiles igen lowered to jumps, in roles, and counts the
+   jumps to each label that are still needed in refs. The blocks have to nest,
+   so whatever iopt made of the others stays as gotos. */
+static void structure(Decl* d, char* roles, int* refs) {
+    int n = list_len(d->sons), top = 0, i, c, j;
+    int* at = alloc(sizeof(int)*(d->labels+1));
+    int* ends = alloc(sizeof(int)*(n+1));
+
+    ends[0] = n;
+    for (i=0; i<n; ++i) {
+        Instr* ir = d->sons[i];
+        roles[i] = Rgoto;
+        if (ir->kind == Ilabel) at[ir->label] = i;
+        else if (ir->kind == Ijmp || ir->kind == Icjmp) ++refs[ir->label];
+    }
+
+    for (i=0; i<n; ++i) {
+        Instr* ir = d->sons[i];
+        while (top && ends[top] <= i) --top;
+        if (roles[i] != Rgoto) continue;
+        if (ir->kind == Ijmp && at[ir->label] == next_instr(d, i)) {
+            roles[i] = Rskip;
+            --refs[ir->label];
+        } else if (ir->kind == Icjmp && at[ir->label] > i &&
+                   at[ir->label] < ends[top]) {
+            roles[i] = Rif;
+            roles[at[ir->label]] = Rendif;
+            --refs[ir->label];
+            ends[++top] = at[ir->label];
+        } else if (ir->kind == Ilabel && loop_at(d, i, at, &c, &j) &&
+                   j < ends[top]) {
+            if (loop_test(d, i, c)) {
+                roles[i] = Rloop;
+                roles[c] = Rcond;
+            } else roles[c] = Rwhile;
+            roles[j] = Rendloop;
+            --refs[d->sons[c]->label];
+            --refs[ir->label];
+            ends[++top] = j;
+        }
+    }
+
+    free(at);
+    free(ends);
+}
+
+static void cgen_label(Instr* ir, int* refs, int depth, Buf* output) {
+    if (!refs[ir->label]) return;
+    indent(depth, output);
+    buf_printf(output, "L%d:;\n", ir->label);
+}
+
+static void cgen_body(Decl* d, Buf* output) {
+    int n = list_len(d->sons), depth = 1, i;
+    char* roles = alloc(n+1);
+    int* refs = alloc(sizeof(int)*(d->labels+1));
+
+    structure(d, roles, refs);
+    for (i=0; i<n; ++i) {
+        Instr* ir = d->sons[i];
+        switch (roles[i]) {
+        case Rgoto:
+            if (ir->kind == Ilabel) cgen_label(ir, refs, depth, output);
+            else cgen_ir(d, ir, depth, output);
+            break;
+        case Rskip: break;
+        case Rif: case Rwhile:
+            generate_varname(ir->v[0]);
+            count_branch(ir, depth, output);
+            indent(depth++, output);
+            buf_puts(output, roles[i] == Rif ? "if (" : "while (");
+            cgen_test(ir, output);
+            buf_puts(output, ") {\n");
+            break;
+        case Rloop:
+            cgen_label(ir, refs, depth, output);
+            indent(depth++, output);
+            buf_puts(output, "for (;;) {\n");
+            break;
+        case Rcond:
+            generate_varname(ir->v[0]);
+            count_branch(ir, depth, output);
+            indent(depth, output);
+            buf_puts(output, "if (!(");
+            cgen_test(ir, output);
+            buf_puts(output, ")) break;\n");
+            break;
+        case Rendif: case Rendloop:
+            indent(--depth, output);
+            buf_puts(output, "}\n");
+            if (ir->kind == Ilabel) cgen_label(ir, refs, depth, output);
+            break;
+        }
+    }
+
+    free(roles);
+    free(refs);
+}
+
+// Is d an initializer that iopt left nothing in?
+static int empty_init(Decl* d) {
+    int i;
+    if (d != d->m->init) return 0;
+    for (i=0; i<list_len(d->sons); ++i) if (d->sons[i]->kind != Inull) return 0;
+    return 1;
+}
+
+static void cgen_fun(Decl* d, Buf* output) {
     int i;
-    if (d->kind != Dfun || d->import) return;
     cgen_proto(d, output);
-    fputs(" {\n", output);
+    buf_puts(output, " {\n");
+    fold_temps(d);
+    share_temps(d);
+    finish_folds(d);
     for (i=0; i<list_len(d->vars); ++i) {
         Var* v = d->vars[i];
         if (!v->type) continue;
         generate_varname(v);
-        fprintf(output, "    %s %s;\n", CNAME(v->type), CNAME(v));
+        // Aliases of the return address (see nrvo in iopt) aren't locals.
+        if (v->deref || v->d.done) continue;
+        if (v->ir && v->ir->kind == Istr) cgen_strlit(v, output);
+        else buf_printf(output, "    %s %s;\n", CNAME(v->type), CNAME(v));
     }
     if (d->rv) {
         generate_varname(d->rv);
         if (!d->ra)
-            fprintf(output, "    %s %s;\n", CNAME(d->ret), CNAME(d->rv));
+            buf_printf(output, "    %s %s;\n", CNAME(d->ret), CNAME(d->rv));
+    }
+    if (profile_out && d->loc) {
+        buf_printf(output, "    ++__blaze_calls[%zu];\n", list_len(call_locs));
+        list_append(call_locs, d->loc);
     }
-    for (i=0; i<list_len(d->sons); ++i) cgen_ir(d, d->sons[i], output);
-    if (d->rv && !d->ra) fprintf(output, "    return %s;\n", CNAME(d->rv));
-    else fputs("    return;\n", output);
-    fputs("}\n\n", output);
+    cgen_body(d, output);
+    if (d->rv && !d->ra) buf_printf(output, "    return %s;\n", CNAME(d->rv));
+    else buf_puts(output, "    return;\n");
+    buf_puts(output, "}\n\n");
+}
+
+const char* cgen_cache = NULL;
+
+/* The cache is keyed on a hash of everything cgen_fun looks at: the IR, and
+   the names and types it refers to. It's salted with CGEN_VERSION, which has
+   to be bumped when cgen_fun writes something different for the same input,
+   so C written by an older cgen isn't reused. */
+
+#define CGEN_VERSION 2
+
+// The cache entries used by this build, by file name (see cgen_prune_cache).
+static DSHtab* cache_used = NULL;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static void hash_bytes(uint64_t* h, const void* p, size_t len) {
+    const unsigned char* b = p;
+    while (len--) *h = (*h ^ *b++) * FNV_PRIME;
+}
+
+static void hash_int(uint64_t* h, long x) { hash_bytes(h, &x, sizeof(x)); }
+
+static void hash_str(uint64_t* h, const char* s) {
+    if (s) hash_bytes(h, s, strlen(s)+1);
+    else hash_int(h, -1);
+}
+
+static void hash_type(uint64_t* h, Type* t) {
+    int i;
+    if (!t) {
+        hash_int(h, -1);
+        return;
+    }
+    if (!t->d.cname) generate_typename(t);
+    hash_str(h, t->d.cname->str);
+    hash_int(h, t->kind);
+    if (t->kind == Tstruct) {
+        // Whether it's copied, and how (see cgen_set).
+        if (t->n->magic[Mcopy])
+            hash_int(h, 1+t->n->magic[Mcopy]->overloads[0]->n->d->ra);
+        else hash_int(h, 0);
+        return;
+    }
+    for (i=0; i<list_len(t->sons); ++i) hash_type(h, t->sons[i]);
+}
+
+static void hash_var(uint64_t* h, Decl* d, Var* v) {
+    int i;
+    if (!v) {
+        hash_int(h, -1);
+        return;
+    }
+    hash_int(h, v->flags);
+    hash_type(h, v->type);
+    if (v->ir == &magic) {
+        hash_int(h, v->deref);
+        hash_var(h, d, v->base);
+        for (i=0; i<list_len(v->av); ++i) hash_var(h, d, *v->av[i]);
+        hash_int(h, list_len(v->iv));
+        for (i=0; i<list_len(v->iv); ++i) hash_var(h, d, v->iv[i]);
+    } else if (v->owner != d) {
+        // Other decls are known by their names, and calls depend on how the
+        // callee returns and whether it's pure.
+        Decl* o = v->owner;
+        generate_declname(o);
+        hash_str(h, o->v->d.cname->str);
+        hash_int(h, o->flags);
+        hash_int(h, o->kind == Dfun && o->ra);
+        if (o->v != v) hash_int(h, v->id);
+    } else {
+        hash_int(h, v->id);
+        hash_str(h, v->name ? v->name->str : NULL);
+        hash_int(h, v->ir ? v->ir->kind : -1);
+        hash_int(h, v->uses != 0);
+    }
+}
+
+static uint64_t decl_hash(Decl* d) {
+    uint64_t h = FNV_OFFSET;
+    int i, j;
+    hash_int(&h, CGEN_VERSION);
+    generate_declname(d);
+    hash_str(&h, d->v->d.cname->str);
+    hash_int(&h, d->flags);
+    hash_int(&h, d->export);
+    hash_str(&h, d->exportc ? d->exportc->str : NULL);
+    hash_int(&h, d->ra);
+    hash_int(&h, d->m == split);
+    hash_type(&h, d->ret);
+    hash_var(&h, d, d->rv);
+    hash_int(&h, list_len(d->args));
+    for (i=0; i<list_len(d->args); ++i) hash_var(&h, d, d->args[i]);
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        hash_int(&h, ir->kind);
+        if (ir->kind == Inull) continue;
+        hash_int(&h, ir->op);
+        hash_int(&h, ir->label);
+        hash_int(&h, ir->flags);
+        hash_str(&h, ir->s ? ir->s->str : NULL);
+        hash_var(&h, d, ir->dst);
+        hash_int(&h, list_len(ir->v));
+        for (j=0; j<list_len(ir->v); ++j) hash_var(&h, d, ir->v[j]);
+    }
+    return h;
+}
+
+static void cgen_decl1(Decl* d, Buf* output) {
+    char name[32], path[1024], tmp[1028];
+    String* key;
+    size_t len;
+    char* text;
+    FILE* f;
+    Buf b = {NULL, 0, 0};
+
+    if (d->kind != Dfun || d->import || empty_init(d)) return;
+    // Profiling counters are numbered across the module.
+    if (!cgen_cache || profile_out || profile_used()) {
+        cgen_fun(d, output);
+        return;
+    }
+
+    snprintf(name, sizeof(name), "%016"PRIx64".c", decl_hash(d));
+    snprintf(path, sizeof(path), "%s/%s", cgen_cache, name);
+    if (!cache_used) cache_used = ds_hnew((DSHashFn)strhash, (DSCmpFn)streq);
+    key = string_new(name);
+    if (ds_hget(cache_used, key)) string_free(key);
+    else ds_hput(cache_used, key, key);
+    if ((f = fopen(path, "r"))) {
+        text = readall(f, &len);
+        fclose(f);
+        if (text) {
+            buf_putsz(output, text, len);
+            free(text);
+            return;
+        }
+    }
+
+    cgen_fun(d, &b);
+    /* A partly written entry would be reused by every later build, so it's
+       written next to the cache and only moved in once complete. (Leftovers
+       are never used, so cgen_prune_cache deletes them.) */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!buf_write(&b, tmp) || rename(tmp, path)) remove(tmp);
+    buf_putsz(output, b.str, b.len);
+    buf_free(&b);
+}
+
+void cgen_prune_cache() {
+    char path[1024];
+    struct dirent* e;
+    String* name;
+    DIR* dir;
+    if (!cgen_cache || !cache_used || !(dir = opendir(cgen_cache))) return;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.') continue;
+        name = string_new(e->d_name);
+        if (!ds_hget(cache_used, name)) {
+            snprintf(path, sizeof(path), "%s/%s", cgen_cache, e->d_name);
+            remove(path);
+        }
+        string_free(name);
+    }
+    closedir(dir);
 }
 
 #define FREE_CNAME(b) do {\
@@ -330,6 +1058,8 @@ static void free_type_cnames(Type* t) {
 }
 
 static List(const char*) all_inits = NULL;
+// The functions that write each module's counters to the profile.
+static List(String*) all_profiles = NULL;
 
 void cgen_free(Module* m) {
     int i;
@@ -337,6 +1067,28 @@ void cgen_free(Module* m) {
     if (m == NULL) {
         list_free(all_inits);
         all_inits = NULL;
+        for (i=0; i<list_len(all_profiles); ++i) string_free(all_profiles[i]);
+        list_free(all_profiles);
+        all_profiles = NULL;
+        if (cache_used) {
+            String** keys = (String**)ds_hkeys(cache_used);
+            for (i=0; i<ds_hcount(cache_used); ++i) string_free(keys[i]);
+            free(keys);
+            ds_hfree(cache_used);
+            cache_used = NULL;
+        }
+        if (fun_names) {
+            String** names = (String**)ds_hkeys(fun_names);
+            String** sigs = (String**)ds_hvals(fun_names);
+            for (i=0; i<ds_hcount(fun_names); ++i) {
+                string_free(names[i]);
+                string_free(sigs[i]);
+            }
+            free(names);
+            free(sigs);
+            ds_hfree(fun_names);
+            fun_names = NULL;
+        }
         return;
     }
 
@@ -349,48 +1101,242 @@ void cgen_free(Module* m) {
 
 #undef FREE_CNAME
 
-static void cgen_header(Module* m, FILE* output, int external) {
+static void reset_typedef(Type* t) {
     int i;
+    if (!t->d.put_typedef) return;
+    t->d.put_typedef = 0;
+    for (i=0; i<list_len(t->sons); ++i) if (t->sons[i]) reset_typedef(t->sons[i]);
+}
+
+/* The module's interface: what its own C files and its dependents' share.
+   Private functions are declared by the C files instead, so changing them
+   doesn't change the header. */
+static void cgen_header(Module* m, Buf* output) {
+    String* name = string_new("H_");
+    int i;
+
+    mangle(name, m->name->str);
+    buf_printf(output, "#ifndef %s\n#define %s\n", name->str, name->str);
+    string_free(name);
+    for (i=0; i<list_len(m->imports); ++i)
+        buf_printf(output, "#include \"%s.h\"\n", m->imports[i]->name->str);
+    buf_puts(output, "extern int __blaze_argc;\nextern char** __blaze_argv;\n");
 
     for (i=0; i<list_len(m->types); ++i)
         cgen_typedef(m->types[i], output);
-    for (i=0; i<list_len(m->types); ++i) m->types[i]->d.put_typedef = 0;
-    fputs("\n\n", output);
+    for (i=0; i<list_len(m->types); ++i) reset_typedef(m->types[i]);
+    buf_puts(output, "\n\n");
 
     for (i=0; i<list_len(m->decls); ++i)
-        cgen_decl0(m->decls[i], output, external);
-    fputs("\n\n", output);
+        if (!private(m->decls[i])) cgen_decl0(m->decls[i], output, 1);
+    buf_puts(output, "\n\n");
 
+    // Other modules' structs are in the headers of the modules they're from.
     for (i=0; i<list_len(m->types); ++i)
-        cgen_typeimpl(m->types[i], output);
-    fputs("\n\n", output);
+        if (m->types[i]->kind == Tstruct &&
+            strcmp(m->types[i]->n->loc.module, m->name->str) == 0)
+            cgen_typeimpl(m->types[i], output);
+    for (i=0; i<list_len(m->types); ++i) m->types[i]->d.done = 0;
+    buf_puts(output, "\n#endif\n");
 }
 
-void cgen(Module* m, FILE* output) {
+// Declares the counters that cgen_decl1 and cgen_ir increment.
+static void cgen_profile_counters(Module* m, Buf* output) {
+    int i, j, calls = 0, branches = 0;
+    for (i=0; i<list_len(m->decls); ++i) {
+        Decl* d = m->decls[i];
+        if (d->kind != Dfun || d->import || !d->loc) continue;
+        ++calls;
+        for (j=0; j<list_len(d->sons); ++j)
+            if (d->sons[j]->kind == Icjmp && d->sons[j]->loc) ++branches;
+    }
+    buf_puts(output, "void __blaze_profile_put(void* f, const char* key, "
+                     "unsigned long* n, int count);\n");
+    buf_printf(output, "static unsigned long __blaze_calls[%d];\n", calls ? calls : 1);
+    buf_printf(output, "static unsigned long __blaze_branches[%d][2];\n\n",
+               branches ? branches : 1);
+}
+
+// Writes the function that adds the module's counters to the profile.
+static void cgen_profile_writer(Module* m, Buf* output) {
+    String* name = string_new("__blaze_profile_"), *key;
     int i;
+    mangle(name, m->name->str);
+
+    buf_printf(output, "void %s(void* f) {\n", name->str);
+    for (i=0; i<list_len(call_locs); ++i) {
+        key = profile_key(call_locs[i]);
+        buf_printf(output, "    __blaze_profile_put(f, \"f %s\", &__blaze_calls[%d], 1);\n",
+                   key->str, i);
+        string_free(key);
+    }
+    for (i=0; i<list_len(branch_locs); ++i) {
+        key = profile_key(branch_locs[i]);
+        buf_printf(output, "    __blaze_profile_put(f, \"b %s\", __blaze_branches[%d], 2);\n",
+                   key->str, i);
+        string_free(key);
+    }
+    buf_puts(output, "}\n\n");
 
-    if (!m->main) fputs("extern ", output);
-    fputs("int __blaze_argc;\n", output);
-    if (!m->main) fputs("extern ", output);
-    fputs("char** __blaze_argv;\n", output);
+    list_append(all_profiles, name);
+    list_free(call_locs);
+    list_free(branch_locs);
+    call_locs = branch_locs = NULL;
+}
 
-    for (i=0; i<list_len(m->imports); ++i) cgen_header(m->imports[i], output, 1);
+/* Writes the code that saves the profile when the program exits. It's a C file
+   of its own since libc's declarations could clash with the modules' imports. */
+void cgen_profile(Buf* output) {
+    const char* p;
+    int i;
+    buf_puts(output, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+    buf_puts(output, "void __blaze_profile_put(void* f, const char* key, "
+                     "unsigned long* n, int count) {\n"
+                     "    char buf[24], *p;\n"
+                     "    unsigned long x;\n"
+                     "    int i;\n"
+                     "    fputs(key, f);\n"
+                     "    for (i=0; i<count; ++i) {\n"
+                     "        p = buf+sizeof(buf)-1;\n"
+                     "        *p = 0;\n"
+                     "        x = n[i];\n"
+                     "        do *--p = '0' + x%10; while (x /= 10);\n"
+                     "        *--p = ' ';\n"
+                     "        fputs(p, f);\n"
+                     "    }\n"
+                     "    fputs(\"\\n\", f);\n"
+                     "}\n\n");
 
-    cgen_header(m, output, 0);
-    for (i=0; i<list_len(m->types); ++i) m->types[i]->d.done = 0;
+    for (i=0; i<list_len(all_profiles); ++i)
+        buf_printf(output, "void %s(void* f);\n", all_profiles[i]->str);
+    buf_puts(output, "\nstatic void __blaze_profile_save(void) {\n"
+                     "    FILE* f = fopen(\"");
+    for (p=profile_out; *p; ++p) {
+        if (*p == '"' || *p == '\\') buf_putc(output, '\\');
+        buf_putc(output, *p);
+    }
+    buf_puts(output, "\", \"w\");\n"
+                     "    if (!f) return;\n");
+    for (i=0; i<list_len(all_profiles); ++i)
+        buf_printf(output, "    %s(f);\n", all_profiles[i]->str);
+    buf_puts(output, "    fclose(f);\n"
+                     "}\n\n"
+                     "void __blaze_profile_start(void) {\n"
+                     "    atexit(__blaze_profile_save);\n"
+                     "}\n");
+}
+
+// Returns m's decls with the most frequently called functions first.
+static List(Decl*) hot_first(Module* m) {
+    List(Decl*) res = NULL;
+    unsigned long* calls = alloc(sizeof(unsigned long)*(list_len(m->decls)+1));
+    int i, j;
+    for (i=0; i<list_len(m->decls); ++i) {
+        Decl* d = m->decls[i];
+        unsigned long c = 0;
+        if (d->kind == Dfun) profile_calls(d->loc, &c);
+        list_append(res, d);
+        for (j=i; j>0 && calls[j-1] < c; --j) {
+            res[j] = res[j-1];
+            calls[j] = calls[j-1];
+        }
+        res[j] = d;
+        calls[j] = c;
+    }
+    free(calls);
+    return res;
+}
+
+// Modules are split into parts of about this many instructions.
+#define PART_SIZE 4096
 
+static int size(Decl* d) {
+    int i, n = 0;
+    if (d->kind != Dfun || d->import) return 0;
+    for (i=0; i<list_len(d->sons); ++i) if (d->sons[i]->kind != Inull) ++n;
+    return n;
+}
+
+int cgen_parts(Module* m) {
+    int i, n = 0, funs = 0;
+    // Profiling counters are static to the module.
+    if (profile_out) return 1;
+    for (i=0; i<list_len(m->decls); ++i) {
+        n += size(m->decls[i]);
+        if (size(m->decls[i])) ++funs;
+    }
+    n = (n + PART_SIZE-1) / PART_SIZE;
+    return n < 1 ? 1 : n > funs ? funs : n;
+}
+
+void cgen(Module* m, Buf* out, int parts) {
+    List(Decl*) decls;
+    Buf* output = &out[1];
+    char buf[64];
+    int i, k, done, total = 0;
+
+    fun_typedefs = ds_hnew((DSHashFn)strhash, (DSCmpFn)streq);
+    split = parts > 1 ? m : NULL;
+
+    /* out[0] is the header. Each C file starts with the hash of it and the
+       headers it includes, so lightbuild (which only hashes the .c files)
+       rebuilds it when an interface it uses changes, but not when only the
+       bodies of another module's functions do. */
+    cgen_header(m, &out[0]);
+    m->hash = FNV_OFFSET;
+    hash_bytes(&m->hash, out[0].str, out[0].len);
+    for (i=0; i<list_len(m->imports); ++i) {
+        bassert(m->imports[i]->hash, "module %s used before its header was generated",
+                m->imports[i]->name->str);
+        hash_bytes(&m->hash, &m->imports[i]->hash, sizeof(m->hash));
+    }
+    snprintf(buf, sizeof(buf), "/* %016"PRIx64" */\n", m->hash);
+    for (i=1; i<=parts; ++i) {
+        buf_puts(&out[i], buf);
+        buf_printf(&out[i], "#include \"%s.h\"\n\n", m->name->str);
+        for (k=0; k<list_len(m->decls); ++k)
+            if (private(m->decls[k])) cgen_decl0(m->decls[k], &out[i], 0);
+        buf_puts(&out[i], "\n");
+    }
+
+    if (m->main) buf_puts(output, "int __blaze_argc;\nchar** __blaze_argv;\n");
     for (i=0; i<list_len(m->decls); ++i)
-        cgen_decl1(m->decls[i], output);
+        if (m->decls[i]->kind == Dglobal && !m->decls[i]->import)
+            cgen_decl0(m->decls[i], output, 0);
+    buf_puts(output, "\n");
 
-    list_append(all_inits, CNAME(m->init->v));
+    if (profile_used())
+        buf_puts(output, "#ifndef __GNUC__\n#define __builtin_expect(x, v) (x)\n#endif\n\n");
+    if (profile_out) cgen_profile_counters(m, output);
+
+    // Hot functions are kept together so they share cache lines and pages.
+    decls = profile_used() ? hot_first(m) : m->decls;
+    for (i=0; i<list_len(decls); ++i) total += size(decls[i]);
+    for (i=k=done=0; i<list_len(decls); ++i) {
+        // Each part gets about the same number of instructions.
+        if (k < parts && done >= (long)total*k/parts) ++k;
+        cgen_decl1(decls[i], &out[k]);
+        done += size(decls[i]);
+    }
+    if (decls != m->decls) list_free(decls);
+    output = &out[parts];
+
+    if (!empty_init(m->init)) list_append(all_inits, CNAME(m->init->v));
+    if (profile_out) cgen_profile_writer(m, output);
 
     if (m->main) {
-        fputs("int main(int argc, char** argv) {\n", output);
-        fputs("    __blaze_argc = argc;\n", output);
-        fputs("    __blaze_argv = argv;\n", output);
+        if (profile_out) buf_puts(output, "void __blaze_profile_start(void);\n\n");
+        buf_puts(output, "int main(int argc, char** argv) {\n");
+        buf_puts(output, "    __blaze_argc = argc;\n");
+        buf_puts(output, "    __blaze_argv = argv;\n");
+        if (profile_out) buf_puts(output, "    __blaze_profile_start();\n");
         for (i=0; i<list_len(all_inits); ++i)
-            fprintf(output, "    %s();\n", all_inits[i]);
-        fprintf(output, "    return %s();\n", CNAME(m->main->v));
-        fputs("}\n", output);
+            buf_printf(output, "    %s();\n", all_inits[i]);
+        buf_printf(output, "    return %s();\n", CNAME(m->main->v));
+        buf_puts(output, "}\n");
     }
+
+    ds_hfree(fun_typedefs);
+    fun_typedefs = NULL;
+    split = NULL;
 }
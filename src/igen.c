@@ -21,6 +21,7 @@ static void igen_struct(Module* m, Node* n) {
         Decl* d = igen_decl(m, n->sons[i]);
         if (d) {
             d->flags |= Fmemb;
+            d->parent = n->type;
             if (n->sons[i]->kind == Nfun) d->v->flags |= Fstc;
             list_append(n->type->d.sons, d);
             if (d->kind == Dfun) list_append(m->decls, d);
@@ -70,10 +71,41 @@ static void igen_index_chain(Decl* d, VarStack* vs, Var* v, Node* n) {
     }
 }
 
+// Struct arguments are passed as read-only references unless the function is
+// a C import/export, which has to keep the C ABI.
+#define BYREF(n) ((n)->kind != Nfun || (!(n)->import && !(n)->exportc))
+
+// Each struct has one read-only reference type, freed along with the struct.
+static Type* cref_type(Module* m, Type* base) {
+    Type* t = base->ref;
+    if (!t) {
+        t = base->ref = new(Type);
+        t->kind = Tptr;
+        t->cref = 1;
+        list_append(t->sons, base);
+    }
+    list_append(m->types, t);
+    return t;
+}
+
+// Returns a reference to v if it is a struct; otherwise, returns v.
+static Var* igen_ref(Decl* d, VarStack* vs, Var* v) {
+    Instr* ir;
+    if (!v->type || v->type->kind != Tstruct) return v;
+    ir = new(Instr);
+    ir->kind = Iaddr;
+    list_append(ir->v, v);
+    ir->flags |= PUREFLAGS(v);
+    ir->dst = var_new(d, ir, cref_type(d->m, v->type), NULL);
+    return instr_result(d, vs, ir);
+}
+
 static void igen_destr(Decl* d, Var* v) {
     Instr* ir;
     STEntry* destr;
     if (!v->type || v->type->kind != Tstruct) return;
+    // String literals live in static storage and are never destroyed.
+    if (v->ir && v->ir->kind == Istr) return;
     destr = v->type->n->magic[Mdelete];
     if (!destr) return;
     ir = new(Instr);
@@ -84,41 +116,118 @@ static void igen_destr(Decl* d, Var* v) {
     instr_result(d, NULL, ir);
 }
 
-static void igen_destr_live_vars(Decl* d, VarStack* vs) {
-    while (vs) {
-        int i;
-        for (i=0; i<list_len(vs->v); ++i) igen_destr(d, vs->v[i]);
-        vs = vs->prev;
+/* Returns share one chain of destructor calls: each node destroys a var and
+   then continues at its parent, and the root continues at the return label.
+   A return jumps to the node for the innermost of its live vars; the vars
+   declared before it follow by construction. */
+typedef struct Cleanup {
+    Decl* d;
+    Var* v;
+    int label, parent;
+} Cleanup;
+
+static List(Cleanup*) cleanups = NULL;
+
+static int needs_destr(Var* v) {
+    return v->type && v->type->kind == Tstruct && !(v->ir && v->ir->kind == Istr)
+           && v->type->n->magic[Mdelete];
+}
+
+static int igen_cleanup_node(Decl* d, Var* v, int parent) {
+    Cleanup* c;
+    int i;
+    for (i=0; i<list_len(cleanups); ++i)
+        if (cleanups[i]->d == d && cleanups[i]->v == v &&
+            cleanups[i]->parent == parent) return cleanups[i]->label;
+    c = new(Cleanup);
+    c->d = d;
+    c->v = v;
+    c->label = d->labels++;
+    c->parent = parent;
+    list_append(cleanups, c);
+    return c->label;
+}
+
+// Returns the label a return has to jump to; moved is the var it moves out.
+static int igen_cleanup(Decl* d, VarStack* vs, Var* moved) {
+    if (!vs) return d->rl;
+    int i, label = igen_cleanup(d, vs->prev, moved);
+    for (i=0; i<list_len(vs->v); ++i)
+        if (vs->v[i] != moved && needs_destr(vs->v[i]))
+            label = igen_cleanup_node(d, vs->v[i], label);
+    return label;
+}
+
+// Emits d's cleanup chain, last node first so most parents are fallen into.
+static void igen_cleanups(Decl* d) {
+    Instr* ir;
+    int i, j, first = 1;
+    for (i=list_len(cleanups)-1; i>=0; --i) {
+        Cleanup* c = cleanups[i];
+        if (c->d != d) continue;
+        if (first) {
+            // Falling off the end doesn't go through the chain.
+            ir = new(Instr);
+            ir->kind = Ijmp;
+            ir->label = d->rl;
+            instr_result(d, NULL, ir);
+            first = 0;
+        }
+        ir = new(Instr);
+        ir->kind = Ilabel;
+        ir->label = c->label;
+        instr_result(d, NULL, ir);
+        igen_destr(d, c->v);
+
+        for (j=i-1; j>=0 && cleanups[j]->d != d; --j);
+        if (j >= 0 ? cleanups[j]->label != c->parent : c->parent != d->rl) {
+            ir = new(Instr);
+            ir->kind = Ijmp;
+            ir->label = c->parent;
+            instr_result(d, NULL, ir);
+        }
+    }
+
+    for (i=j=0; i<list_len(cleanups); ++i)
+        if (cleanups[i]->d == d) free(cleanups[i]);
+        else cleanups[j++] = cleanups[i];
+    if (cleanups) list_lenref(cleanups) = j;
+    if (!j) {
+        list_free(cleanups);
+        cleanups = NULL;
     }
 }
 
 static Var* igen_node(Decl* d, VarStack* vs, Node* n) {
     Instr* ir = new(Instr);
-    Var* v;
+    Var* v, *v2;
     Type* t;
-    int i, label;
+    int i, label, byref;
     VarStack vvs;
     switch (n->kind) {
     case Nbody:
         vvs = igen_sons(d, vs, n);
-        for (i=0; i<list_len(vvs.v); ++i) igen_destr(d, vvs.v[i]);
+        for (i=list_len(vvs.v)-1; i>=0; --i) igen_destr(d, vvs.v[i]);
         list_free(vvs.v);
         instr_free(ir);
         ir = NULL;
         break;
     case Nreturn:
+        v = NULL;
         if (n->sons) {
             ir->kind = Isr;
             list_append(ir->v, igen_node(d, vs, n->sons[0]));
             instr_result(d, vs, ir); // XXX
+            // Locals are moved out (see cgen_ir), so they aren't destroyed.
+            if (movable(d, ir->v[0])) v = ir->v[0];
             ir = new(Instr);
         }
-        igen_destr_live_vars(d, vs);
         ir->kind = Ijmp;
-        ir->label = d->rl;
+        ir->label = igen_cleanup(d, vs, v);
         break;
     case Nif:
         ir->kind = Icjmp;
+        ir->loc = &n->loc;
         list_append(ir->v, igen_node(d, vs, n->sons[0]));
         ir->label = label = d->labels++;
         instr_result(d, vs, ir); // XXX
@@ -136,6 +245,7 @@ static Var* igen_node(Decl* d, VarStack* vs, Node* n) {
 
         ir = new(Instr);
         ir->kind = Icjmp;
+        ir->loc = &n->loc;
         list_append(ir->v, igen_node(d, vs, n->sons[0]));
         ir->label = label+1;
         instr_result(d, vs, ir); // XXX
@@ -154,6 +264,7 @@ static Var* igen_node(Decl* d, VarStack* vs, Node* n) {
     case Nlet:
         ir->kind = Inew;
         n->v = ir->dst = var_new(d, ir, n->type, n->s);
+        ir->dst->flags |= n->flags & Fmv;
         list_append(ir->v, igen_node(d, vs, n->sons[0]));
         ir->flags |= PUREFLAGS(ir->v[0]);
         break;
@@ -185,6 +296,7 @@ static Var* igen_node(Decl* d, VarStack* vs, Node* n) {
         return v;
     case Nnew: case Ncall:
         ir->kind = n->kind == Nnew ? Iconstr : Icall;
+        byref = !n->sons[0]->e || !n->sons[0]->e->n || BYREF(n->sons[0]->e->n);
         v = n->sons[0]->kind == Nid && n->sons[0]->e->n->kind == Nfun &&
             (!strcmp(n->sons[0]->e->n->s->str, "[]") ||
              !strcmp(n->sons[0]->e->n->s->str, "&[]")) ?
@@ -196,11 +308,14 @@ static Var* igen_node(Decl* d, VarStack* vs, Node* n) {
             list_append(t->sons, n->type);
         } else t = n->flags & Fvoid ? NULL : n->type;
         ir->dst = var_new(d, ir, t, NULL);
-        for (i=0; i<list_len(n->sons); ++i)
-            list_append(ir->v, igen_node(d, vs, n->sons[i]));
+        for (i=0; i<list_len(n->sons); ++i) {
+            v2 = igen_node(d, vs, n->sons[i]);
+            list_append(ir->v, i && byref ? igen_ref(d, vs, v2) : v2);
+        }
         if (v) {
             ir->v[0] = var_new(d, &magic, n->sons[0]->type, NULL);
             ir->v[0]->base = v;
+            ++v->uses;
             igen_decl(d->m, n->sons[0]->e->n);
             bassert(n->sons[0]->e->n->d, "igen of [] has no decl");
             list_append(ir->v[0]->av, &n->sons[0]->e->n->d->v);
@@ -297,6 +412,7 @@ static void igen_func(Module* m, Decl* d, Node* n) {
         orig = n->this->type;
         n->this->type = new(Type);
         n->this->type->kind = Tptr;
+        n->this->type->cref = !(n->flags & Fmvm);
         list_append(n->this->type->sons, orig);
         type_incref(n->this->type);
         n->this->v->type = n->this->type;
@@ -318,8 +434,16 @@ static void igen_func(Module* m, Decl* d, Node* n) {
             Node* arg = n->sons[1]->sons[i];
             bassert(arg->kind == Ndecl, "unexpected node kind %d", arg->kind);
             Var* v = var_new(d, NULL, arg->type, arg->s);
+            if (arg->type->kind == Tstruct && BYREF(n)) {
+                // Take a reference and deref it on use, just like this.
+                v->type = cref_type(m, arg->type);
+                v->flags |= Farg;
+                list_append(d->args, v);
+                v = var_new(d, &magic, arg->type, NULL);
+                v->base = d->args[list_len(d->args)-1];
+                v->deref = 1;
+            } else list_append(d->args, v);
             v->flags |= Farg;
-            list_append(d->args, v);
             arg->v = v;
         }
     }
@@ -344,6 +468,7 @@ static void igen_func(Module* m, Decl* d, Node* n) {
         Instr* ir = new(Instr);
         d->rl = d->labels++;
         igen_node(d, NULL, n->sons[2]);
+        igen_cleanups(d);
         ir->kind = Ilabel;
         ir->label = d->rl;
         instr_result(d, NULL, ir);
@@ -375,6 +500,7 @@ static Decl* igen_decl(Module* m, Node* n) {
     if (n->s) n->d->name = string_clone(n->s);
     if (n->export) n->d->export = 1;
     n->d->m = m;
+    n->d->loc = &n->loc;
 
     switch (n->kind) {
     case Nfun:
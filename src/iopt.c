@@ -4,11 +4,13 @@
 
 #include "blaze.h"
 
+#include <sys/time.h>
+
 // "Deletes" the given IR.
 static void nir(Instr* ir) {
     int i;
+    if (ir->kind == Inull) return;
     ir->kind = Inull;
-    if (ir->dst && ir->dst->uses) --ir->dst->uses;
     for (i=0; i<list_len(ir->v); ++i) --ir->v[i]->uses;
 }
 
@@ -18,7 +20,7 @@ static int remove_unused_vars(Decl* d) {
         if (d->vars[i]->uses == 0 && d->vars[i]->type &&
             !(d->vars[i]->ir && d->vars[i]->ir->kind == Iconstr) &&
             !(d->vars[i]->ir && d->vars[i]->ir->kind == Icall &&
-              d->vars[i]->ir->v[0]->owner->ra)) {
+              call_target(d->vars[i]->ir->v[0])->owner->ra)) {
             // This will cause code generators to not emit space for the variable.
             d->vars[i]->type = NULL;
             for (j=0; j<list_len(d->vars[i]->destr); ++j)
@@ -38,23 +40,1119 @@ static void remove_useless_news(Decl* d) {
         Instr* ir = d->sons[i];
         if (ir->kind == Inew && ir->v[0]->uses == (list_len(ir->v[0]->destr)+1) &&
             !ir->v[0]->name && ir->v[0]->ir && ir->v[0]->ir != &magic) {
+            int lit = ir->v[0]->ir->kind == Istr;
+            // A mutable copy of a string literal can't share its storage.
+            if (lit && ir->dst->flags & Fmv) continue;
             ir->v[0]->ir->dst = ir->dst;
             ir->dst->ir = ir->v[0]->ir;
             ir->v[0]->type = NULL;
             for (j=0; j<list_len(ir->v[0]->destr); ++j) nir(ir->v[0]->destr[j]);
+            if (lit)
+                for (j=0; j<list_len(ir->dst->destr); ++j) nir(ir->dst->destr[j]);
             nir(ir);
+        } else if (ir->kind == Iset &&
+                   ir->v[1]->uses == (list_len(ir->v[1]->destr)+1) &&
+                   !ir->v[1]->name && ir->v[1]->ir && ir->v[1]->ir != &magic &&
+                   ir->v[1]->ir->kind != Istr) {
+            // The temporary dies here anyway, so it can be moved, not copied.
+            for (j=0; j<list_len(ir->v[1]->destr); ++j) nir(ir->v[1]->destr[j]);
+            ir->flags |= Fmove;
+        }
+    }
+}
+
+/* Named return value optimization: if every return in an address-returning
+   function returns the same local, that local becomes an alias of the
+   caller-provided return address, so the Isr moves go away. */
+static void nrvo(Decl* d) {
+    int i;
+    Var* v = NULL;
+    if (!d->ra) return;
+
+    for (i=0; i<list_len(d->sons); ++i)
+        if (d->sons[i]->kind == Isr) {
+            if (v && d->sons[i]->v[0] != v) return;
+            v = d->sons[i]->v[0];
+        }
+    if (!v || v->owner != d || !v->ir || v->ir == &magic || v->ir->kind == Istr)
+        return;
+
+    // The return paths don't destroy v (see igen_cleanup), so it survives.
+    for (i=0; i<list_len(d->sons); ++i)
+        if (d->sons[i]->kind == Isr) nir(d->sons[i]);
+
+    v->base = d->rv;
+    v->deref = 1;
+}
+
+// Functions with at most this many instructions are inlined into their callers.
+#define INLINE_LIMIT 8
+// With a profile, hot functions may have this many times as many.
+#define HOT_INLINE_FACTOR 4
+
+typedef struct Inline {
+    Decl* d, *f; // The caller and the callee.
+    List(Var*) from; // The callee's variables...
+    List(Var*) to; // ...and what they became in the caller.
+    List(Instr*) irs; // The callee's instructions...
+    List(Instr*) copies; // ...and their copies.
+    List(Instr*)* out; // Where the copies go.
+} Inline;
+
+static int module_visible(Module* m, Module* target) {
+    int i;
+    if (m == target) return 1;
+    for (i=0; i<list_len(m->imports); ++i)
+        if (m->imports[i] == target) return 1;
+    return 0;
+}
+
+// Can v still be referred to once f's body is inside d?
+static int can_inline_var(Decl* d, Decl* f, Var* v) {
+    int i;
+    if (v->owner == f) {
+        if (v == f->v || v == f->rv) return 0;
+        if (v->base && !can_inline_var(d, f, v->base)) return 0;
+        for (i=0; i<list_len(v->av); ++i)
+            if (!can_inline_var(d, f, *v->av[i])) return 0;
+        for (i=0; i<list_len(v->iv); ++i)
+            if (!can_inline_var(d, f, v->iv[i])) return 0;
+        return 1;
+    }
+    // Anything else is a decl, which mustn't be static to another module.
+    return v->owner->v == v && module_visible(d->m, v->owner->m) &&
+           (v->owner->m == d->m || v->owner->export || v->owner->import ||
+            v->owner->exportc);
+}
+
+// Returns the function the call can be replaced with the body of, or NULL.
+static Decl* inline_callee(Decl* d, Instr* call) {
+    Var* t;
+    Decl* f;
+    unsigned long calls;
+    int i, j, this, size=0, returns=0, limit=INLINE_LIMIT;
+    if (call->kind != Icall && call->kind != Iconstr) return NULL;
+    t = call_target(call->v[0]);
+    f = t->owner;
+    if (f == d || f->v != t || f->kind != Dfun || f->import || f->ra || !f->sons)
+        return NULL;
+    // Code that never ran isn't worth growing.
+    if (profile_calls(d->loc, &calls) && !calls) return NULL;
+    if (profile_calls(f->loc, &calls)) {
+        if (!calls) return NULL;
+        if (profile_hot(calls)) limit *= HOT_INLINE_FACTOR;
+    }
+    this = call->kind == Iconstr || (t->flags & Fstc && call->v[0]->base);
+    if (list_len(f->args) != list_len(call->v)-1+this) return NULL;
+    for (i=0; i<list_len(f->args); ++i)
+        if (f->args[i]->type->kind == Tstruct) return NULL;
+
+    for (i=0; i<list_len(f->sons); ++i) {
+        Instr* ir = f->sons[i];
+        if (ir->kind == Inull) continue;
+        if (ir->kind == Isr) ++returns;
+        if ((ir->kind == Ijmp || ir->kind == Ilabel) && ir->label == f->rl)
+            continue;
+        if (++size > limit) return NULL;
+        if (ir->dst && !can_inline_var(d, f, ir->dst)) return NULL;
+        for (j=0; j<list_len(ir->v); ++j)
+            if (!can_inline_var(d, f, ir->v[j])) return NULL;
+    }
+    return returns <= 1 ? f : NULL;
+}
+
+static void inline_map(Inline* in, Var* from, Var* to) {
+    list_append(in->from, from);
+    list_append(in->to, to);
+}
+
+// Returns the caller's version of the callee's variable v.
+static Var* inline_var(Inline* in, Var* v) {
+    Var* res, *base;
+    int i;
+    if (v->owner != in->f) return v;
+    for (i=0; i<list_len(in->from); ++i)
+        if (in->from[i] == v) return in->to[i];
+
+    if (v->ir == &magic) {
+        base = v->base ? inline_var(in, v->base) : NULL;
+        if (v->deref && base->owner == in->d && base->ir && base->ir != &magic &&
+            base->ir->kind == Iaddr &&
+            (base->type->cref || base->ir->v[0]->ir != &magic)) {
+            // *&x is just x.
+            inline_map(in, v, base->ir->v[0]);
+            return base->ir->v[0];
+        }
+        res = var_new(in->d, &magic, v->type, v->name);
+        res->deref = v->deref;
+        if ((res->base = base)) ++base->uses;
+        for (i=0; i<list_len(v->av); ++i) list_append(res->av, v->av[i]);
+        for (i=0; i<list_len(v->iv); ++i) {
+            list_append(res->iv, inline_var(in, v->iv[i]));
+            ++res->iv[i]->uses;
+        }
+    } else {
+        for (i=0; i<list_len(in->irs) && in->irs[i] != v->ir; ++i);
+        if (i == list_len(in->irs)) {
+            // The var's instruction was optimized out (see sroa).
+            bassert(v->ir->kind == Inull, "inlined var %d has no instruction", v->id);
+            list_append(in->irs, v->ir);
+            list_append(in->copies, new(Instr));
+            list_append(*in->out, in->copies[i]);
+        }
+        res = var_new(in->d, in->copies[i], v->type, v->name);
+    }
+    res->flags = v->flags;
+    inline_map(in, v, res);
+    return res;
+}
+
+// Appends a copy of f's body in place of the call to the instructions in out.
+static void inline_call(Decl* d, Decl* f, Instr* call, List(Instr*)* out) {
+    Inline in;
+    Instr* ir, *c, *addr=NULL;
+    Var* v;
+    int i, j, jumps=0, label=d->labels;
+    int this = list_len(f->args) - (list_len(call->v)-1);
+
+    memset(&in, 0, sizeof(in));
+    in.d = d;
+    in.f = f;
+    in.out = out;
+    d->labels += f->labels;
+
+    if (this) {
+        // Methods are passed the address of the object they're called on, and
+        // constructors that of the object they construct.
+        v = call->kind == Iconstr ? call->dst : call->v[0]->base;
+        if (list_len(call->v[0]->av) > 1) {
+            v = var_new(d, &magic, f->args[0]->type->sons[0], NULL);
+            v->base = call->v[0]->base;
+            ++v->base->uses;
+            for (i=0; i<list_len(call->v[0]->av)-1; ++i)
+                list_append(v->av, call->v[0]->av[i]);
+        }
+        ir = new(Instr);
+        ir->kind = Iaddr;
+        list_append(ir->v, v);
+        ++v->uses;
+        ir->dst = var_new(d, ir, f->args[0]->type, NULL);
+        list_append(*out, ir);
+        inline_map(&in, f->args[0], ir->dst);
+        addr = ir;
+    }
+
+    for (i=this; i<list_len(f->args); ++i) {
+        v = call->v[i-this+1];
+        if (v->name || !v->ir || v->ir == &magic || v->owner != d) {
+            // Only temporaries are sure not to change while the body runs.
+            ir = new(Instr);
+            ir->kind = Inew;
+            list_append(ir->v, v);
+            ++v->uses;
+            ir->dst = var_new(d, ir, f->args[i]->type, NULL);
+            list_append(*out, ir);
+            v = ir->dst;
+        }
+        inline_map(&in, f->args[i], v);
+    }
+
+    for (i=0; i<list_len(f->sons); ++i) {
+        ir = f->sons[i];
+        if (ir->kind == Inull) continue;
+        if (ir->kind == Ijmp && ir->label == f->rl) {
+            for (j=i+1; j<list_len(f->sons) && f->sons[j]->kind == Inull; ++j);
+            // Jumping straight to the end is the same as falling through.
+            if (j < list_len(f->sons) && f->sons[j]->kind == Ilabel &&
+                f->sons[j]->label == f->rl) continue;
+            ++jumps;
+        }
+        if (ir->kind == Ilabel && ir->label == f->rl && !jumps) continue;
+
+        c = new(Instr);
+        *c = *ir;
+        c->dst = NULL;
+        c->v = NULL;
+        if (ir->kind == Iint || ir->kind == Istr) c->s = string_clone(ir->s);
+        if (ir->kind == Icjmp || ir->kind == Ijmp || ir->kind == Ilabel)
+            c->label += label;
+        list_append(in.irs, ir);
+        list_append(in.copies, c);
+
+        if (ir->kind == Isr) {
+            // The returned value is the call's result.
+            c->kind = Inew;
+            c->dst = call->dst;
+            call->dst->ir = c;
+        } else if (ir->dst) c->dst = inline_var(&in, ir->dst);
+        for (j=0; j<list_len(ir->v); ++j) {
+            list_append(c->v, inline_var(&in, ir->v[j]));
+            ++c->v[j]->uses;
+        }
+        if (c->kind == Idel) list_append(c->v[1]->destr, c);
+        list_append(*out, c);
+    }
+
+    nir(call);
+    // Usually, only the deref of this was used, and that became the object.
+    if (addr && !addr->dst->uses) nir(addr);
+
+    list_free(in.from);
+    list_free(in.to);
+    list_free(in.irs);
+    list_free(in.copies);
+}
+
+/* Replaces calls to small functions, including those in imported modules, with
+   a copy of their bodies. Copies aren't inlined into again, so recursion always
+   stops. */
+static void inline_calls(Decl* d) {
+    List(Instr*) sons = NULL;
+    int i;
+    for (i=0; i<list_len(d->sons); ++i) {
+        Decl* f = inline_callee(d, d->sons[i]);
+        list_append(sons, d->sons[i]);
+        if (f) inline_call(d, f, d->sons[i], &sons);
+    }
+    list_free(d->sons);
+    d->sons = sons;
+}
+
+// Returns the argument of d that v holds, or NULL.
+static Var* arg_value(Decl* d, Var* v) {
+    int i;
+    // Struct arguments are passed on as the address of their deref.
+    if (v->ir && v->ir != &magic && v->ir->kind == Iaddr && v->ir->v[0]->deref)
+        v = v->ir->v[0]->base;
+    for (i=0; i<list_len(d->args); ++i) if (d->args[i] == v) return v;
+    return NULL;
+}
+
+// Is v a temporary computed by an instruction of its own?
+static int temp(Var* v) {
+    return v->ir && v->ir != &magic && !v->name && !(v->flags & Farg);
+}
+
+static Instr* new_instr(int kind, int label) {
+    Instr* ir = new(Instr);
+    ir->kind = kind;
+    ir->label = label;
+    return ir;
+}
+
+/* Follows the path from instruction i to the return label, collecting the
+   destructors on the way into destr. Returns 0 if anything else happens on
+   it. The destructors will run before the call, so only the builtin ones,
+   which just release memory, are allowed. */
+static int return_path(Decl* d, int* labels, int i, List(Instr*)* destr) {
+    int steps;
+    for (steps=0; steps<list_len(d->sons) && i<list_len(d->sons); ++steps) {
+        Instr* ir = d->sons[i++];
+        switch (ir->kind) {
+        case Inull: case Ilabel: break;
+        case Idel:
+            if (!builtins_module || ir->v[0]->owner->m != builtins_module->m)
+                return 0;
+            list_append(*destr, ir);
+            break;
+        case Ijmp:
+            if (ir->label == d->rl) return 1;
+            i = labels[ir->label];
+            break;
+        default: return 0;
+        }
+        if (ir->kind == Ilabel && ir->label == d->rl) return 1;
+    }
+    return 0;
+}
+
+/* Turns calls of a function to itself that are immediately returned into
+   reassignments of the arguments and a jump back to the start. The pending
+   destructors are copied in front of the jump; since they (and the restart)
+   may clobber the function's locals, pointers are only passed on if they're
+   arguments themselves. */
+static void tail_calls(Decl* d) {
+    List(Instr*) sons = NULL;
+    List(Instr*) destr = NULL;
+    List(Var*) src = NULL;
+    Instr* sr, *ir;
+    int* labels;
+    int i, j, entry = -1;
+    if (d->ra) return;
+    for (i=0; i<list_len(d->args); ++i)
+        if (d->args[i]->type->kind == Tstruct) return;
+
+    labels = alloc(sizeof(int)*(d->labels+1));
+    for (i=0; i<list_len(d->sons); ++i)
+        if (d->sons[i]->kind == Ilabel) labels[d->sons[i]->label] = i;
+
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* call = d->sons[i];
+        list_append(sons, call);
+
+        if (call->kind != Icall || call->v[0] != d->v ||
+            list_len(call->v)-1 != list_len(d->args))
+            continue;
+        for (j=i+1; j<list_len(d->sons) && d->sons[j]->kind == Inull; ++j);
+        sr = j < list_len(d->sons) && d->sons[j]->kind == Isr &&
+             d->sons[j]->v[0] == call->dst ? d->sons[j] : NULL;
+        if (!sr && d->ret) continue;
+        if (list_len(destr)) list_lenref(destr) = 0;
+        if (!return_path(d, labels, sr ? j+1 : j, &destr)) continue;
+        for (j=1; j<list_len(call->v); ++j)
+            if (call->v[j]->type->kind == Tptr && !arg_value(d, call->v[j])) break;
+        if (j < list_len(call->v)) continue;
+
+        /* The arguments are set one after the other, so every new value that
+           could read one (an argument passed on in a different position, a
+           field read through one...) is copied first. Only those passed on in
+           the same position and fresh temporaries are used as they are. */
+        for (j=1; j<list_len(call->v); ++j) {
+            Var* v = arg_value(d, call->v[j]);
+            if (!v) v = call->v[j];
+            if (v != d->args[j-1] && !temp(v)) {
+                ir = new_instr(Inew, 0);
+                list_append(ir->v, v);
+                ++v->uses;
+                ir->dst = var_new(d, ir, v->type, NULL);
+                list_append(sons, ir);
+                v = ir->dst;
+            }
+            list_append(src, v);
+        }
+        for (j=0; j<list_len(src); ++j) {
+            if (src[j] == d->args[j]) continue;
+            ir = new_instr(Iset, 0);
+            list_append(ir->v, d->args[j]);
+            list_append(ir->v, src[j]);
+            ++d->args[j]->uses;
+            ++src[j]->uses;
+            list_append(sons, ir);
+        }
+        list_lenref(src) = 0;
+        for (j=0; j<list_len(destr); ++j) {
+            ir = new_instr(Idel, 0);
+            list_append(ir->v, destr[j]->v[0]);
+            list_append(ir->v, destr[j]->v[1]);
+            ++ir->v[0]->uses;
+            ++ir->v[1]->uses;
+            list_append(ir->v[1]->destr, ir);
+            list_append(sons, ir);
+        }
+
+        if (entry == -1) entry = d->labels++;
+        list_append(sons, new_instr(Ijmp, entry));
+        if (sr) nir(sr);
+        nir(call);
+    }
+
+    free(labels);
+    list_free(destr);
+    list_free(src);
+    list_free(d->sons);
+    d->sons = NULL;
+    if (entry != -1) list_append(d->sons, new_instr(Ilabel, entry));
+    for (i=0; i<list_len(sons); ++i) list_append(d->sons, sons[i]);
+    list_free(sons);
+}
+
+static int same_type(Type* a, Type* b) {
+    if (a == b) return 1;
+    if (!a || !b || a->kind != b->kind) return 0;
+    switch (a->kind) {
+    case Tbuiltin: return a->bkind == b->bkind;
+    case Tptr: return a->cref == b->cref && same_type(a->sons[0], b->sons[0]);
+    default: return 0;
+    }
+}
+
+static int same_var(Var* a, Var* b) {
+    int i;
+    if (a == b) return 1;
+    if (a->ir != &magic || b->ir != &magic || a->deref != b->deref ||
+        list_len(a->av) != list_len(b->av) || list_len(a->iv) != list_len(b->iv) ||
+        !a->base || !b->base || !same_var(a->base, b->base))
+        return 0;
+    for (i=0; i<list_len(a->av); ++i) if (a->av[i] != b->av[i]) return 0;
+    for (i=0; i<list_len(a->iv); ++i) if (!same_var(a->iv[i], b->iv[i])) return 0;
+    return 1;
+}
+
+// Can nothing but the instruction that created v change it?
+static int stable(Decl* d, Var* v) {
+    return v->owner == d && v->ir != &magic && !(v->flags & Fmv);
+}
+
+// Can the result of ir only change if its operands are reassigned?
+static int stable_result(Decl* d, Instr* ir) {
+    int i;
+    // Addresses of locals are constant.
+    if (ir->kind == Iaddr) return ir->v[0]->ir != &magic;
+    for (i=0; i<list_len(ir->v); ++i) if (!stable(d, ir->v[i])) return 0;
+    return 1;
+}
+
+static int same_instr(Instr* a, Instr* b) {
+    int i;
+    if (a->kind != b->kind || a->op != b->op || list_len(a->v) != list_len(b->v) ||
+        !same_type(a->dst->type, b->dst->type))
+        return 0;
+    if (a->kind == Iint && !streq(a->s, b->s)) return 0;
+    for (i=0; i<list_len(a->v); ++i) if (!same_var(a->v[i], b->v[i])) return 0;
+    return 1;
+}
+
+// Returns what v was replaced with by cse.
+static Var* cse_var(List(Var*) from, List(Var*) to, Var* v) {
+    int i;
+    if (v->ir == &magic) {
+        if (v->base) v->base = cse_var(from, to, v->base);
+        for (i=0; i<list_len(v->iv); ++i) v->iv[i] = cse_var(from, to, v->iv[i]);
+        return v;
+    }
+    for (i=0; i<list_len(from); ++i)
+        if (from[i] == v) {
+            ++to[i]->uses;
+            --v->uses;
+            return to[i];
+        }
+    return v;
+}
+
+/* Common subexpression elimination: an operation, cast, address or constant
+   that has already been computed in the same basic block (and whose operands
+   can't have changed since) reuses the earlier result. Anything that might
+   write to memory ends the lifetime of results that read it. */
+static void cse(Decl* d) {
+    List(Instr*) avail = NULL;
+    List(Var*) from = NULL;
+    List(Var*) to = NULL;
+    int i, j;
+
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        for (j=0; j<list_len(ir->v); ++j) ir->v[j] = cse_var(from, to, ir->v[j]);
+
+        switch (ir->kind) {
+        case Ilabel: case Ijmp:
+            if (avail) list_lenref(avail) = 0;
+            break;
+        case Inew: case Iset: case Isr: case Icall: case Iconstr: case Idel:
+            for (j=0; j<list_len(avail); ++j)
+                if (!stable_result(d, avail[j]))
+                    avail[j--] = avail[--list_lenref(avail)];
+            break;
+        case Iop: case Icast: case Iaddr: case Iint:
+            if (!ir->dst->type || ir->dst->type->kind == Tstruct ||
+                !stable(d, ir->dst))
+                break;
+            for (j=0; j<list_len(avail); ++j)
+                if (same_instr(avail[j], ir)) break;
+            if (j == list_len(avail)) {
+                list_append(avail, ir);
+                break;
+            }
+            list_append(from, ir->dst);
+            list_append(to, avail[j]->dst);
+            ir->dst->type = NULL;
+            nir(ir);
+            break;
+        default: break;
+        }
+    }
+
+    list_free(avail);
+    list_free(from);
+    list_free(to);
+}
+
+// Can v be replaced by one variable per field?
+static int splittable(Decl* d, Var* v) {
+    int i, j;
+    // Anything that was constructed by a call escapes as this.
+    if (!v->type || v->type->kind != Tstruct || v->deref || !v->ir ||
+        v->ir == &magic || v->ir->kind != Inull)
+        return 0;
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull || (ir->kind == Iaddr && !ir->dst->uses)) continue;
+        if (ir->dst == v) return 0;
+        for (j=0; j<list_len(ir->v); ++j) if (ir->v[j] == v) return 0;
+    }
+    for (i=0; i<list_len(d->mvars); ++i)
+        if (d->mvars[i]->base == v && d->mvars[i]->uses &&
+            (!d->mvars[i]->av || (*d->mvars[i]->av[0])->owner->kind != Dglobal))
+            return 0;
+    return 1;
+}
+
+static void replace_var(Decl* d, Var* from, Var* to) {
+    int i, j;
+    for (i=0; i<list_len(d->sons); ++i)
+        for (j=0; j<list_len(d->sons[i]->v); ++j)
+            if (d->sons[i]->v[j] == from) {
+                d->sons[i]->v[j] = to;
+                if (d->sons[i]->kind != Inull) ++to->uses;
+            }
+    for (i=0; i<list_len(d->mvars); ++i) {
+        Var* m = d->mvars[i];
+        if (m->base == from) {
+            m->base = to;
+            ++to->uses;
+        }
+        for (j=0; j<list_len(m->iv); ++j)
+            if (m->iv[j] == from) {
+                m->iv[j] = to;
+                ++to->uses;
+            }
+    }
+}
+
+/* Scalar replacement of aggregates: a struct local that's only ever accessed
+   through its fields (usually because its constructor was inlined) becomes a
+   separate local per field. Returns whether anything was split. */
+static int sroa(Decl* d) {
+    int i, j, k, split=0;
+    for (i=0; i<list_len(d->vars); ++i) {
+        Var* v = d->vars[i];
+        List(Decl*) members;
+        List(Var*) fields = NULL;
+        if (!splittable(d, v)) continue;
+
+        members = v->type->d.sons;
+        for (j=0; j<list_len(members); ++j) {
+            Var* f = NULL;
+            if (members[j]->kind == Dglobal) {
+                f = var_new(d, v->ir, members[j]->v->type, members[j]->v->name);
+                f->flags |= Fmv;
+            }
+            list_append(fields, f);
+        }
+
+        for (j=0; j<list_len(d->mvars); ++j) {
+            Var* m = d->mvars[j];
+            if (m->base != v || !m->uses) continue;
+            for (k=0; members[k]->v != *m->av[0]; ++k);
+            if (list_len(m->av) > 1) {
+                // The rest of the chain is accessed on the field.
+                m->base = fields[k];
+                ++fields[k]->uses;
+                memmove(m->av, m->av+1, sizeof(Var**)*(list_len(m->av)-1));
+                --list_lenref(m->av);
+            } else replace_var(d, m, fields[k]);
+        }
+
+        v->type = NULL;
+        list_free(fields);
+        split = 1;
+    }
+    return split;
+}
+
+static int address_taken(Decl* d, Var* v) {
+    int i;
+    for (i=0; i<list_len(d->sons); ++i)
+        if (d->sons[i]->kind == Iaddr) {
+            Var* root = d->sons[i]->v[0];
+            while (root->base && !root->deref) root = root->base;
+            if (root == v) return 1;
+        }
+    return 0;
+}
+
+// Can v be relied on not to change while d->sons[h..j] runs, apart from hoisted?
+static int invariant(Decl* d, int h, int j, List(Instr*) hoisted, Var* v) {
+    int i;
+    if (v->ir == &magic || v->owner != d) return 0;
+    for (i=h; i<=j; ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Iset && ir->v[0] == v) return 0;
+        if (ir == v->ir) {
+            int k;
+            for (k=0; k<list_len(hoisted); ++k) if (hoisted[k] == ir) break;
+            if (k == list_len(hoisted)) return 0;
+        }
+    }
+    return stable(d, v) || !address_taken(d, v);
+}
+
+static int hoistable(Decl* d, int h, int j, List(Instr*) hoisted, Instr* ir) {
+    int i;
+    switch (ir->kind) {
+    case Iop:
+        // Don't make a division that might not have run trap.
+        if (ir->op == Odiv) return 0;
+        break;
+    case Iaddr:
+        // Addresses of locals are constant.
+        if (ir->v[0]->ir != &magic) return stable(d, ir->dst);
+        return 0;
+    case Icast: case Iint: break;
+    default: return 0;
+    }
+    if (!ir->dst->type || ir->dst->type->kind == Tstruct || !stable(d, ir->dst))
+        return 0;
+    for (i=0; i<list_len(ir->v); ++i)
+        if (!invariant(d, h, j, hoisted, ir->v[i])) return 0;
+    return 1;
+}
+
+/* Loop-invariant code motion. A while loop is a label followed later by a jump
+   back to it; computations inside it that don't depend on anything the loop
+   changes are moved in front of the label. Inner loops come first, so their
+   invariants can then leave outer loops too. */
+static void licm(Decl* d) {
+    int* labels = alloc(sizeof(int)*(d->labels+1));
+    int i, j, k, n;
+
+    for (i=0; i<list_len(d->sons); ++i)
+        if (d->sons[i]->kind == Ilabel) labels[d->sons[i]->label] = i;
+
+    for (j=0; j<list_len(d->sons); ++j) {
+        List(Instr*) hoisted = NULL;
+        int h = labels[d->sons[j]->label];
+        if (d->sons[j]->kind != Ijmp || h >= j ||
+            d->sons[h]->kind != Ilabel || d->sons[h]->label != d->sons[j]->label)
+            continue;
+        for (i=h+1; i<j; ++i)
+            if (hoistable(d, h, j, hoisted, d->sons[i]))
+                list_append(hoisted, d->sons[i]);
+        if (!hoisted) continue;
+
+        // Rotate the hoisted instructions in front of the loop's label.
+        n = list_len(hoisted);
+        for (i=j-1, k=j-1; i>=h; --i) {
+            int l;
+            for (l=0; l<n && hoisted[l] != d->sons[i]; ++l);
+            if (l == n) d->sons[k--] = d->sons[i];
+        }
+        for (i=0; i<n; ++i) d->sons[h+i] = hoisted[i];
+        for (i=h; i<=j; ++i)
+            if (d->sons[i]->kind == Ilabel) labels[d->sons[i]->label] = i;
+        list_free(hoisted);
+    }
+
+    free(labels);
+}
+
+// Can values of type t be computed at compile time? (char's sign varies.)
+static int const_type(Type* t) {
+    return t && t->kind == Tbuiltin && t->bkind != Tchar;
+}
+
+// Converts x to t like C does.
+static uintmax_t wrap(Type* t, uintmax_t x) {
+    switch (t->bkind) {
+    case Tint: case Tbool: return (intmax_t)(int)x;
+    case Tbyte: return (unsigned char)x;
+    case Tsize: return (unsigned long)x;
+    default: fatal("unexpected builtin type %d", t->bkind);
+    }
+}
+
+static int is_signed(Type* t) { return t->bkind == Tint || t->bkind == Tbool; }
+
+// Finds the value of v in vars; returns 0 if it isn't known.
+static int const_value(List(Var*) vars, uintmax_t* values, Var* v, uintmax_t* x) {
+    int i;
+    for (i=list_len(vars)-1; i>=0; --i) if (vars[i] == v) {
+        *x = values[i];
+        return 1;
+    }
+    return 0;
+}
+
+// Computes the value ir produces; returns 0 if it can't.
+static int eval_instr(List(Var*) vars, uintmax_t* values, Instr* ir, uintmax_t* x) {
+    uintmax_t a, b;
+    char* end;
+    Var* dst = ir->kind == Iset ? ir->v[0] : ir->dst;
+    if (!dst || !const_type(dst->type) || dst->ir == &magic) return 0;
+
+    switch (ir->kind) {
+    case Iint:
+        errno = 0;
+        *x = strtoumax(ir->s->str, &end, 10);
+        if (errno || (*end && strncmp(end, "/*", 2) != 0)) return 0;
+        break;
+    case Inew: case Icast:
+        if (!const_type(ir->v[0]->type) ||
+            !const_value(vars, values, ir->v[0], x)) return 0;
+        break;
+    case Iset:
+        if (!const_type(ir->v[1]->type) ||
+            !const_value(vars, values, ir->v[1], x)) return 0;
+        break;
+    case Iop:
+        if (!const_type(ir->v[0]->type) || !const_type(ir->v[1]->type) ||
+            !const_value(vars, values, ir->v[0], &a) ||
+            !const_value(vars, values, ir->v[1], &b)) return 0;
+        // Only these don't depend on which type the operands are converted to.
+        if (ir->v[0]->type->bkind != ir->v[1]->type->bkind &&
+            ir->op != Oadd && ir->op != Osub && ir->op != Omul) return 0;
+        switch (ir->op) {
+        case Oadd: *x = a + b; break;
+        case Osub: *x = a - b; break;
+        case Omul: *x = a * b; break;
+        case Odiv:
+            if (b == 0) return 0;
+            *x = is_signed(ir->v[0]->type) ? (uintmax_t)((intmax_t)a / (intmax_t)b)
+                                           : a / b;
+            break;
+        case Oeq: *x = a == b; break;
+        case One: *x = a != b; break;
+        case Olt:
+            *x = is_signed(ir->v[0]->type) ? (intmax_t)a < (intmax_t)b : a < b;
+            break;
+        case Ogt:
+            *x = is_signed(ir->v[0]->type) ? (intmax_t)a > (intmax_t)b : a > b;
+            break;
+        default: return 0;
+        }
+        break;
+    default: return 0;
+    }
+
+    *x = wrap(dst->type, *x);
+    return 1;
+}
+
+static void set_const(List(Var*)* vars, uintmax_t** values, Var* v, uintmax_t x) {
+    int i;
+    for (i=0; i<list_len(*vars) && (*vars)[i] != v; ++i);
+    if (i == list_len(*vars)) {
+        list_append(*vars, v);
+        *values = ralloc(*values, sizeof(uintmax_t)*list_len(*vars));
+    }
+    (*values)[i] = x;
+}
+
+static void forget_const(List(Var*) vars, uintmax_t* values, Var* v) {
+    int i;
+    for (i=0; i<list_len(vars); ++i)
+        if (vars[i] == v || (!v && vars[i]->owner->kind == Dglobal)) {
+            vars[i] = vars[list_len(vars)-1];
+            values[i--] = values[--list_lenref(vars)];
         }
+}
+
+/* Runs the module initializer at compile time up to its first branch, and
+   turns the globals it sets to builtin values into static initializers. Like
+   C++'s constant initialization, those are set before any of the rest runs. */
+static void eval_init(Decl* d) {
+    List(Var*) vars = NULL;
+    uintmax_t* values = NULL;
+    char buf[64];
+    int i;
+    if (d != d->m->init) return;
+
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        Var* dst = ir->kind == Iset ? ir->v[0] : ir->dst;
+        Decl* g = dst ? dst->owner : NULL;
+        uintmax_t x;
+        if (ir->kind == Ilabel || ir->kind == Ijmp || ir->kind == Icjmp) break;
+        if (ir->kind == Inull) continue;
+        if (!eval_instr(vars, values, ir, &x)) {
+            if (dst) forget_const(vars, values, dst);
+            // Anything could have changed the globals.
+            if (!(ir->flags & Fpure)) forget_const(vars, values, NULL);
+        } else if (g->kind == Dglobal && g->v == dst && g->m == d->m && !g->import &&
+                   ir->kind == Iset) {
+            if (is_signed(dst->type)) snprintf(buf, sizeof(buf), "%jd", (intmax_t)x);
+            else snprintf(buf, sizeof(buf), "%ju%s", x,
+                          dst->type->bkind == Tsize ? "UL" : "");
+            g->value = string_new(buf);
+            nir(ir);
+            set_const(&vars, &values, dst, x);
+        } else if (g->kind == Dglobal) forget_const(vars, values, dst);
+        else set_const(&vars, &values, dst, x);
+    }
+
+    list_free(vars);
+    free(values);
+}
+
+static void sroa_all(Decl* d) { while (sroa(d)); }
+static void remove_all_unused_vars(Decl* d) { while (remove_unused_vars(d)); }
+
+typedef struct Pass {
+    const char* name;
+    void (*run)(Decl* d);
+    int level; // The lowest -O level it runs at, or -1 if it's always needed.
+    int disabled;
+    // Statistics, summed over all runs.
+    double time;
+    int runs, removed, added, changed;
+} Pass;
+
+static Pass passes[] = {
+    // Copies of constructed values have to be elided, or str.dup would recurse.
+    {"news", remove_useless_news, -1},
+    {"inline", inline_calls, 2},
+    {"tail-calls", tail_calls, 2},
+    {"cse", cse, 1},
+    {"sroa", sroa_all, 2},
+    {"licm", licm, 2},
+    {"nrvo", nrvo, 1},
+    {"eval-init", eval_init, 1},
+    {"unused-vars", remove_all_unused_vars, 1},
+};
+
+#define NPASSES (sizeof(passes)/sizeof(passes[0]))
+
+// The order passes run in; some run more than once.
+static const char* pipeline[] = {
+    "news", "inline", "tail-calls", "cse", "news", "sroa", "licm", "nrvo",
+    "eval-init", "unused-vars",
+};
+
+int opt_level = 2;
+
+static Pass* find_pass(const char* name) {
+    int i;
+    for (i=0; i<NPASSES; ++i) if (strcmp(passes[i].name, name) == 0)
+        return &passes[i];
+    return NULL;
+}
+
+int iopt_disable(const char* name) {
+    Pass* p = find_pass(name);
+    if (!p || p->level == -1) return 0;
+    p->disabled = 1;
+    return 1;
+}
+
+void iopt_pass_names(FILE* f) {
+    int i;
+    for (i=0; i<NPASSES; ++i)
+        if (passes[i].level != -1) fprintf(f, "%s ", passes[i].name);
+    fputc('\n', f);
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Sums up everything about ir a pass could change.
+static uintptr_t instr_hash(Instr* ir) {
+    uintptr_t h = ir->kind * 31 + ir->op;
+    int i;
+    h = h * 31 + (uintptr_t)ir->dst;
+    h = h * 31 + ir->label;
+    h = h * 31 + ir->flags;
+    for (i=0; i<list_len(ir->v); ++i) h = h * 31 + (uintptr_t)ir->v[i];
+    return h;
+}
+
+/* Runs p on d and counts what it did to the instructions: the ones that were
+   optimized out, the ones that are new and the others that differ. Passes only
+   ever add to and reorder d->sons, so the old instructions are all still
+   there. */
+static void run_pass(Pass* p, Decl* d) {
+    int i, n = list_len(d->sons), live = 0;
+    Instr** old = alloc(sizeof(Instr*)*(n+1));
+    uintptr_t* hashes = alloc(sizeof(uintptr_t)*(n+1));
+    double start;
+
+    for (i=0; i<n; ++i) {
+        old[i] = d->sons[i];
+        hashes[i] = instr_hash(old[i]);
+        if (old[i]->kind != Inull) ++live;
+        else old[i] = NULL;
+    }
+
+    start = now();
+    p->run(d);
+    p->time += now() - start;
+    ++p->runs;
+
+    for (i=0; i<n; ++i) {
+        if (!old[i] || hashes[i] == instr_hash(old[i])) continue;
+        if (old[i]->kind == Inull) {
+            ++p->removed;
+            --live;
+        } else ++p->changed;
+    }
+    // Whatever is live now and wasn't before is new.
+    for (i=0; i<list_len(d->sons); ++i) if (d->sons[i]->kind != Inull) --live;
+    p->added -= live;
+
+    free(old);
+    free(hashes);
+}
+
+void iopt_dump_stats(FILE* f) {
+    int i;
+    fprintf(f, "%-12s %5s %10s %8s %8s %8s\n", "pass", "runs", "time (ms)",
+            "removed", "added", "changed");
+    for (i=0; i<NPASSES; ++i) {
+        Pass* p = &passes[i];
+        fprintf(f, "%-12s %5d %10.3f %8d %8d %8d%s\n", p->name, p->runs,
+                p->time * 1000, p->removed, p->added, p->changed,
+                p->disabled ? " (disabled)" : "");
     }
 }
 
 static void opt_decl(Decl* d) {
+    int i;
     if (d->kind != Dfun) return;
-
-    remove_useless_news(d);
-    while (remove_unused_vars(d));
+    for (i=0; i<sizeof(pipeline)/sizeof(pipeline[0]); ++i) {
+        Pass* p = find_pass(pipeline[i]);
+        bassert(p, "unknown pass %s", pipeline[i]);
+        if (!p->disabled && p->level <= opt_level) run_pass(p, d);
+    }
 }
 
 void iopt(Module* m) {
     int i;
     for (i=0; i<list_len(m->decls); ++i) opt_decl(m->decls[i]);
 }
+
+// Is v stored in d's own frame, rather than reached through a pointer or global?
+static int frame_var(Decl* d, Var* v) {
+    for (; v && v->ir == &magic; v = v->base)
+        if (v->deref || v->iv) return 0;
+    return v && v->owner == d;
+}
+
+// Returns the flags d can have given what its callees have now.
+static int purity(Decl* d) {
+    int i, j, res = Fpure | Fcst;
+    if (d->ra || d->import || d == d->m->init) return 0;
+
+    for (i=0; i<list_len(d->sons) && res; ++i) {
+        Instr* ir = d->sons[i];
+        switch (ir->kind) {
+        case Inull: case Ijmp: case Ilabel: continue;
+        // Constructors and destructors change their objects through pointers.
+        case Iconstr: case Idel: return 0;
+        case Icall: {
+            Var* t = call_target(ir->v[0]);
+            if (t->owner->kind != Dfun || t->owner->v != t) return 0;
+            res &= t->owner->flags;
+            break;
+        }
+        default: break;
+        }
+
+        if (ir->kind == Iset && !frame_var(d, ir->v[0])) return 0;
+        if (ir->dst && !frame_var(d, ir->dst)) return 0;
+        if (ir->kind == Iaddr) continue;
+        for (j=ir->kind == Icall; j<list_len(ir->v); ++j)
+            if (!frame_var(d, ir->v[j])) res &= ~Fcst;
+    }
+    return res;
+}
+
+/* Finds the functions that don't change anything but their locals (which are
+   marked Fpure) and of those, the ones that don't read anything but those and
+   their arguments either (also marked Fcst). Everything starts out as both,
+   and loses what it turns out not to be until nothing changes; that way,
+   recursion doesn't rule purity out. */
+void infer_purity(List(Module*) mods) {
+    int i, j, changed;
+    if (!opt_level) return;
+
+    for (i=0; i<list_len(mods); ++i)
+        for (j=0; j<list_len(mods[i]->decls); ++j)
+            if (mods[i]->decls[j]->kind == Dfun)
+                mods[i]->decls[j]->flags |= Fpure | Fcst;
+
+    do {
+        changed = 0;
+        for (i=0; i<list_len(mods); ++i)
+            for (j=0; j<list_len(mods[i]->decls); ++j) {
+                Decl* d = mods[i]->decls[j];
+                int flags;
+                if (d->kind != Dfun || !(d->flags & Fpure)) continue;
+                flags = purity(d);
+                if (flags != (d->flags & (Fpure | Fcst))) {
+                    d->flags = (d->flags & ~(Fpure | Fcst)) | flags;
+                    changed = 1;
+                }
+            }
+    } while (changed);
+}
+
+// Is v one of d's arguments or its return address? (They aren't marked Farg.)
+static int is_arg(Decl* d, Var* v) {
+    int i;
+    for (i=0; i<list_len(d->args); ++i) if (d->args[i] == v) return 1;
+    return d->ra && v == d->rv;
+}
+
+/* Returns the pointer argument (or return address) through which v is reached,
+   NULL if v is in d's frame, or d->v if v may be anywhere else. */
+static Var* access_root(Decl* d, Var* v) {
+    Var* res = NULL;
+    int i;
+    for (; v && v->ir == &magic; v = v->base) {
+        for (i=0; i<list_len(v->iv); ++i)
+            if (access_root(d, v->iv[i])) return d->v;
+        if (!v->deref && !v->iv) continue;
+        // Pointers loaded from memory aren't "based on" the argument in C.
+        if (res || !v->base || !is_arg(d, v->base))
+            return d->v;
+        res = v->base;
+    }
+    if (!v || v->owner != d) return d->v;
+    return res;
+}
+
+static int is_ptr_arg(Decl* d, Var* v) {
+    return v && v->type && v->type->kind == Tptr && is_arg(d, v);
+}
+
+// Notes in *root the argument v is reached through; returns 0 if it's not the
+// only one seen.
+static int note_access(Decl* d, Var* v, Var** root) {
+    Var* r = access_root(d, v);
+    if (r == d->v || (r && *root && r != *root)) return 0;
+    if (r) *root = r;
+    return 1;
+}
+
+/* A pointer argument can be restrict if its target can't change while it's
+   accessed some other way. That holds for all of them in pure functions, which
+   change nothing, and for one that's the only way the function reaches
+   memory outside its frame, if the function only calls const functions. */
+static void restrict_args(Decl* d) {
+    Var* root = NULL, *t;
+    int i, j;
+    if (d->kind != Dfun || d->import) return;
+
+    for (i=0; i<list_len(d->sons); ++i) {
+        Instr* ir = d->sons[i];
+        if (ir->kind == Inull || ir->kind == Ijmp || ir->kind == Ilabel) continue;
+        // Arguments that are reassigned point to different things over time.
+        if (ir->kind == Iset && is_arg(d, ir->v[0])) return;
+        if (d->flags & Fpure) continue;
+
+        if (ir->kind == Iconstr || ir->kind == Idel) return;
+        if (ir->kind == Icall) {
+            t = call_target(ir->v[0]);
+            if (t->owner->v != t || !(t->owner->flags & Fcst)) return;
+        }
+        if (ir->kind == Isr && d->ra) root = root ? root : d->rv;
+        if (ir->kind == Isr && d->ra && root != d->rv) return;
+        if (ir->dst && !note_access(d, ir->dst, &root)) return;
+        if (ir->kind == Iaddr) continue;
+        for (j=ir->kind == Icall; j<list_len(ir->v); ++j)
+            if (!note_access(d, ir->v[j], &root)) return;
+    }
+
+    if (d->flags & Fpure) {
+        for (i=0; i<list_len(d->args); ++i)
+            if (is_ptr_arg(d, d->args[i])) d->args[i]->flags |= Fnoalias;
+    } else if (is_ptr_arg(d, root)) root->flags |= Fnoalias;
+}
+
+void infer_restrict(List(Module*) mods) {
+    int i, j;
+    if (!opt_level) return;
+    for (i=0; i<list_len(mods); ++i)
+        for (j=0; j<list_len(mods[i]->decls); ++j) restrict_args(mods[i]->decls[j]);
+}
@@ -4,11 +4,9 @@
 
 #include "blaze.h"
 
-static int var_counter = 0;
-
 Var* var_new(Decl* owner, Instr* ir, Type* type, String* name) {
     Var* res = new(Var);
-    res->id = var_counter++;
+    res->id = owner->ids++;
     res->uses = 0;
     res->owner = owner;
     res->ir = ir;
@@ -22,6 +20,18 @@ Var* var_new(Decl* owner, Instr* ir, Type* type, String* name) {
     return res;
 }
 
+Var* call_target(Var* v) {
+    // Methods are called through an attribute chain ending in the method.
+    return v->av ? *v->av[list_len(v->av)-1] : v;
+}
+
+/* Can returning v from d move it instead of copying it? Only locals can be
+   moved, and string literals don't own their data (see cgen_strlit). */
+int movable(Decl* d, Var* v) {
+    return v->owner == d && !(v->flags & Farg) &&
+           !(v->ir && v->ir != &magic && v->ir->kind == Istr);
+}
+
 void var_dump(Var* v) {
     bassert(v, "expected non-null var");
     printf("Var ");
@@ -148,6 +158,7 @@ void decl_free(Decl* d) {
     list_free(d->mvars);
     list_free(d->args);
     if (d->name) string_free(d->name);
+    if (d->value) string_free(d->value);
     if (d->v) var_free(d->v);
     if (d->rv) var_free(d->rv);
     free(d);
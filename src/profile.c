@@ -0,0 +1,114 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "blaze.h"
+
+/* Profiles are written by programs built with --profile-generate (see cgen),
+   one counter per line:
+
+       f <module>:<line>:<column> <calls>
+       b <module>:<line>:<column> <true> <false>
+
+   Functions and branches are identified by where they are in the source, so
+   copies made by the inliner count towards the original. */
+
+const char* profile_out = NULL;
+
+typedef struct Counts {
+    unsigned long n[2];
+} Counts;
+
+static DSHtab* profile = NULL;
+static unsigned long max_calls = 0;
+
+String* profile_key(Location* loc) {
+    char buf[32];
+    String* res = string_new(loc->module);
+    snprintf(buf, sizeof(buf), ":%d:%d", loc->first_line, loc->first_column);
+    string_merges(res, buf);
+    return res;
+}
+
+int profile_load(const char* path) {
+    char kind, key[256];
+    unsigned long a, b;
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "error opening %s for reading: %s\n", path,
+                strerror(errno));
+        return 0;
+    }
+
+    profile = ds_hnew((DSHashFn)strhash, (DSCmpFn)streq);
+    while (fscanf(f, " %c %255s %lu", &kind, key, &a) == 3) {
+        String* s = string_new(key);
+        Counts* c = ds_hget(profile, s);
+        b = 0;
+        if (kind == 'b' && fscanf(f, "%lu", &b) != 1) {
+            string_free(s);
+            break;
+        }
+        if (!c) {
+            c = new(Counts);
+            ds_hput(profile, s, c);
+        } else string_free(s);
+        // The same function or branch may be counted more than once.
+        c->n[0] += a;
+        c->n[1] += b;
+        if (kind == 'f' && c->n[0] > max_calls) max_calls = c->n[0];
+    }
+
+    if (!feof(f)) fprintf(stderr, "error reading profile %s\n", path);
+    fclose(f);
+    return 1;
+}
+
+void profile_free() {
+    int i, kc;
+    String** keys;
+    Counts** values;
+    if (!profile) return;
+    kc = ds_hcount(profile);
+    keys = (String**)ds_hkeys(profile);
+    values = (Counts**)ds_hvals(profile);
+    for (i=0; i<kc; ++i) {
+        string_free(keys[i]);
+        free(values[i]);
+    }
+    free(keys);
+    free(values);
+    ds_hfree(profile);
+    profile = NULL;
+}
+
+static Counts* lookup(Location* loc) {
+    String* key;
+    Counts* res;
+    if (!profile || !loc) return NULL;
+    key = profile_key(loc);
+    res = ds_hget(profile, key);
+    string_free(key);
+    return res;
+}
+
+int profile_calls(Location* loc, unsigned long* calls) {
+    Counts* c = lookup(loc);
+    if (c) *calls = c->n[0];
+    return c != NULL;
+}
+
+int profile_branch(Location* loc, unsigned long* on_true, unsigned long* on_false) {
+    Counts* c = lookup(loc);
+    if (c) {
+        *on_true = c->n[0];
+        *on_false = c->n[1];
+    }
+    return c != NULL;
+}
+
+int profile_used() { return profile != NULL; }
+
+int profile_hot(unsigned long calls) {
+    return calls && calls >= max_calls / 16;
+}
@@ -36,20 +36,18 @@ String* string_add(String* lhs, String* rhs) {
     return res;
 }
 
+static void merge(String* base, const char* rhs, size_t len) {
+    base->str = ralloc(base->str, base->len+len+1);
+    memcpy(base->str+base->len, rhs, len);
+    base->str[base->len+len] = 0;
+    base->len += len;
+}
+
 void string_merge(String* base, String* rhs) {
     bassert(base && rhs, "expected non-null strings");
-    base->str = ralloc(base->str, base->len+rhs->len+1);
-    memcpy(base->str+base->len, rhs->str, rhs->len);
-    base->str[base->len+rhs->len] = 0;
-    base->len += rhs->len;
-}
-void string_mergec(String* base, char rhs) {
-    String* rhss = string_newz(&rhs, 1);
-    string_merge(base, rhss);
-    string_free(rhss);
+    merge(base, rhs->str, rhs->len);
 }
+void string_mergec(String* base, char rhs) { merge(base, &rhs, 1); }
 void string_merges(String* base, const char* rhs) {
-    String* rhss = string_new(rhs);
-    string_merge(base, rhss);
-    string_free(rhss);
+    merge(base, rhs, strlen(rhs));
 }
@@ -113,7 +113,13 @@ void type_decref(Type* t) {
     bassert(t && t->rc, "unbalanced reference count");
     if (--t->rc) return;
     switch (t->kind) {
-    case Tany: case Tbuiltin: case Tstruct: string_free(t->name); break;
+    case Tstruct:
+        if (t->ref) {
+            list_free(t->ref->sons);
+            free(t->ref);
+        }
+        // Fallthrough.
+    case Tany: case Tbuiltin: string_free(t->name); break;
     default: break;
     }
     for (i=0; i<list_len(t->sons); ++i) if (t->sons[i]) type_decref(t->sons[i]);
@@ -392,6 +398,8 @@ void type(Node* n) {
         if (n->sons[1]) type(n->sons[1]);
         n->type = new(Type);
         n->type->kind = Tfun;
+        // C imports and exports keep the C ABI (see igen_func).
+        n->type->byval = n->import || n->exportc;
         type_incref(n->type);
         if (n->sons[0]) {
             list_append(n->type->sons, n->sons[0]->type);
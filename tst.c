@@ -6,10 +6,38 @@
 
 #include <assert.h>
 
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-O0|-O1|-O2] [-fno-<pass>]... [-stats] "
+                    "[-native] [--profile-generate[=<profile>]] [--profile-use[=<profile>]] "
+                    "<file> <output>\npasses: ", prog);
+    iopt_pass_names(stderr);
+    exit(1);
+}
+
 int main(int argc, char** argv) {
     LexerContext* ctx;
     Config config;
-    assert(argc == 3);
+    int arg, stats = 0;
+
+    for (arg=1; arg<argc && argv[arg][0] == '-'; ++arg) {
+        const char* opt = argv[arg];
+        if (strlen(opt) == 3 && opt[1] == 'O' && opt[2] >= '0' && opt[2] <= '2')
+            opt_level = opt[2] - '0';
+        else if (strncmp(opt, "-fno-", 5) == 0) {
+            if (!iopt_disable(opt+5)) usage(argv[0]);
+        }
+        else if (strcmp(opt, "-stats") == 0) stats = 1;
+        else if (strcmp(opt, "-native") == 0) native = 1;
+        else if (strncmp(opt, "--profile-generate", 18) == 0 &&
+                 (!opt[18] || opt[18] == '='))
+            profile_out = opt[18] ? opt+19 : PROFILE;
+        else if (strncmp(opt, "--profile-use", 13) == 0 &&
+                 (!opt[13] || opt[13] == '=')) {
+            if (!profile_load(opt[13] ? opt+14 : PROFILE)) return 1;
+        } else usage(argv[0]);
+    }
+    // The profiling counters are only written by cgen.
+    if (argc - arg != 2 || (native && profile_out)) usage(argv[0]);
     lex_init();
     modtab_init();
     init_builtin_types();
@@ -20,7 +48,7 @@ int main(int argc, char** argv) {
     assert(parse_file(LIBDIR BUILTINS ".blz", BUILTINS));
     #endif
 
-    ctx = parse_file(argv[1], "__main__");
+    ctx = parse_file(argv[arg], "__main__");
     if (ctx) {
         if (errors == 0) {
             int i, kc = ds_hcount(modules);
@@ -48,17 +76,22 @@ int main(int argc, char** argv) {
                     list_append(mods, m);
                 }
 
+                infer_purity(mods);
+                infer_restrict(mods);
+
                 if (!exists(".blaze")) assert(pmkdir(".blaze"));
-                build(argv[2], config, mods);
+                build(argv[arg+1], config, mods);
 
                 for (i=0; i<list_len(mods); ++i) module_free(mods[i]);
                 list_free(mods);
             }
 
             free(ctxs);
+            if (stats) iopt_dump_stats(stderr);
         }
     }
     free_config(config);
+    profile_free();
     lex_free();
     modtab_free();
     free_builtin_types();